@@ -0,0 +1,1819 @@
+/*
+ *  Copyright (c) 2018 Zuoshui Zhou <zuoshui.zhou@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of version 2.1 of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+// Benchmarks, no OpenCV needed. Usage: ./bench <workload> [options]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <linux/perf_event.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "qrtree.hpp"
+#include "qrpacked.hpp"
+#include "qrsharded.hpp"
+
+#define REGION_X 2000
+#define REGION_Y 2000
+#define RADIUS_MAX 20
+
+// every heap allocation of the process goes through here, so allocator calls can be counted
+static std::atomic<std::size_t> g_allocs{0};
+
+static void* Allocate(std::size_t n, std::size_t align){
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    void *p = nullptr;
+    if(align <= alignof(std::max_align_t))
+        p = std::malloc(n ? n : 1);
+    else if(posix_memalign(&p, align, n ? n : 1) != 0)
+        p = nullptr;
+    if(!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+// out of line, as a free inlined into the callers is taken for a mismatch with new
+__attribute__((noinline)) static void Release(void *p) noexcept{std::free(p);}
+
+void* operator new(std::size_t n){return Allocate(n, 0);}
+void* operator new[](std::size_t n){return Allocate(n, 0);}
+void* operator new(std::size_t n, std::align_val_t a){return Allocate(n, std::size_t(a));}
+void* operator new[](std::size_t n, std::align_val_t a){return Allocate(n, std::size_t(a));}
+void* operator new(std::size_t n, const std::nothrow_t&) noexcept{
+    try{return Allocate(n, 0);}catch(...){return nullptr;}
+}
+void* operator new[](std::size_t n, const std::nothrow_t&) noexcept{
+    try{return Allocate(n, 0);}catch(...){return nullptr;}
+}
+void* operator new(std::size_t n, std::align_val_t a, const std::nothrow_t&) noexcept{
+    try{return Allocate(n, std::size_t(a));}catch(...){return nullptr;}
+}
+void* operator new[](std::size_t n, std::align_val_t a, const std::nothrow_t&) noexcept{
+    try{return Allocate(n, std::size_t(a));}catch(...){return nullptr;}
+}
+
+void operator delete(void *p) noexcept{Release(p);}
+void operator delete[](void *p) noexcept{Release(p);}
+void operator delete(void *p, std::size_t) noexcept{Release(p);}
+void operator delete[](void *p, std::size_t) noexcept{Release(p);}
+void operator delete(void *p, std::align_val_t) noexcept{Release(p);}
+void operator delete[](void *p, std::align_val_t) noexcept{Release(p);}
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept{Release(p);}
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept{Release(p);}
+void operator delete(void *p, const std::nothrow_t&) noexcept{Release(p);}
+void operator delete[](void *p, const std::nothrow_t&) noexcept{Release(p);}
+void operator delete(void *p, std::align_val_t, const std::nothrow_t&) noexcept{Release(p);}
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t&) noexcept{Release(p);}
+
+static double Seconds(){
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// hardware cache-miss counter of this thread, reads -1 where perf events are not allowed
+struct CacheMisses{
+    int fd;
+
+    CacheMisses(){
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    ~CacheMisses(){
+        if(fd >= 0)
+            close(fd);
+    }
+
+    long long read() const{
+        long long n = -1;
+        if(fd < 0 || ::read(fd, &n, sizeof(n)) != sizeof(n))
+            return -1;
+        return n;
+    }
+};
+
+static Circle RandomCircle(std::mt19937 &gen){
+    std::uniform_real_distribution<double> x(0, REGION_X), y(0, REGION_Y), r(0, RADIUS_MAX);
+    Circle cir{};
+    cir.x = x(gen);
+    cir.y = y(gen);
+    cir.r = r(gen);
+    return cir;
+}
+
+// FIFO churn: fill the tree up to its window, then keep inserting so that every
+// insert also expires the oldest leaf.
+static void BenchChurn(std::size_t window, std::size_t ops, std::size_t slab){
+    std::mt19937 gen(1);
+    QRTree tree{window, 2, 10, 20, slab};
+
+    for(std::size_t i = 0; i < window; ++i)
+        tree.InsertData(RandomCircle(gen));
+
+    const std::size_t allocs = g_allocs;
+    const double t0 = Seconds();
+    for(std::size_t i = 0; i < ops; ++i)
+        tree.InsertData(RandomCircle(gen));
+    const double t = Seconds() - t0;
+
+    std::printf("churn slab=%-4zu window=%zu ops=%zu  %10.0f inserts/s  %8.3f allocs/insert\n",
+        slab, window, ops, ops / t, double(g_allocs - allocs) / ops);
+}
+
+static std::size_t QueryAll(QRTree &tree, const std::vector<QRBoundingBox> &windows){
+    std::size_t hits = 0;
+    for(auto &bb: windows){
+        auto res = tree.Query(bb);
+        hits += res->size();
+        delete res;
+    }
+    return hits;
+}
+
+static std::vector<QRBoundingBox> RandomWindows(std::mt19937 &gen, std::size_t n, double side){
+    std::uniform_real_distribution<double> x(0, REGION_X - side), y(0, REGION_Y - side);
+    std::vector<QRBoundingBox> windows;
+    for(std::size_t i = 0; i < n; ++i){
+        const double x0 = x(gen), y0 = y(gen);
+        windows.emplace_back(x0, x0 + side, y0, y0 + side);
+    }
+    return windows;
+}
+
+// Quality of the tree over FIFO churn, from Stats() after every round of window inserts:
+// height, nodes, overlap and dead space in units of the region, and what the writer and
+// a fixed set of queries did in the round
+static void BenchStats(std::size_t window, std::size_t rounds){
+    std::mt19937 gen(17);
+    QRTree tree{window};
+    const auto windows = RandomWindows(gen, 1000, 50);
+    const double region = double(REGION_X) * REGION_Y;
+
+    std::printf("round  height    nodes   overlap      dead  splits  reinserts  condensed  "
+        "visited/q  tested/q  returned/q\n");
+    for(std::size_t r = 0; r <= rounds; ++r){
+        if(r > 0)
+            for(std::size_t i = 0; i < window; ++i)
+                tree.InsertData(RandomCircle(gen));
+        for(auto &bb: windows)
+            tree.Query(bb, [](const Circle &){return true;});
+
+        const QRStatistics stats = tree.Stats();
+        std::size_t nodes = 0;
+        for(auto n: stats.nodes)
+            nodes += n;
+        const auto &c = stats.counters;
+        std::printf("%5zu  %6d  %7zu  %8.3f  %8.3f  %6lu  %9lu  %9lu  %9.1f  %8.1f  %10.1f\n",
+            r, stats.height, nodes, stats.total_overlap / region, stats.total_dead / region,
+            (unsigned long)c.splits, (unsigned long)c.reinserts, (unsigned long)c.condensed,
+            double(c.visited) / c.queries, double(c.tested) / c.queries, double(c.returned) / c.queries);
+        tree.ResetStats();
+    }
+}
+
+// inserts at steady state of a full window, expiring one at a time or in batches, by
+// count or by a ttl of window ticks with one insert per tick
+static void BenchExpiry(std::size_t window, std::size_t ops){
+    for(int ttl = 0; ttl < 2; ++ttl)
+        for(std::size_t batch: {1, 16, 64, 256, 1024}){
+            std::mt19937 gen(1);
+            QRTree tree{window};
+            tree.Set_expiry(batch, ttl ? window : 0);
+
+            std::uint64_t now = 0;
+            for(std::size_t i = 0; i < 2 * window; ++i)
+                tree.InsertData(RandomCircle(gen), ++now);
+
+            const double t0 = Seconds();
+            for(std::size_t i = 0; i < ops; ++i)
+                tree.InsertData(RandomCircle(gen), ++now);
+            const double t = Seconds() - t0;
+
+            // the tree left behind should query as well as the one-at-a-time one
+            const auto windows = RandomWindows(gen, 20000, 50);
+            std::size_t hits = 0;
+            const double q0 = Seconds();
+            for(auto &bb: windows)
+                tree.Query(bb, [&hits](const Circle &){
+                    ++hits;
+                    return true;
+                });
+            const double q = Seconds() - q0;
+
+            std::printf("expiry %-5s batch=%-5zu window=%zu ops=%zu  %10.0f inserts/s  size=%zu  %10.0f queries/s\n",
+                ttl ? "ttl" : "count", batch, window, ops, ops / t, tree.Get_size(), windows.size() / q);
+        }
+}
+
+// n circles drift by at most step per axis and tick, moved by Update, by Update with a
+// CompactStep between ticks, or by a Delete of their box and a new InsertData. Delete takes
+// whatever overlaps the box, so the last loses neighbours on the way.
+static void BenchMoving(std::size_t n, std::size_t ticks, double step){
+    std::uniform_real_distribution<double> move(-step, step);
+    const std::size_t unbounded = std::size_t(1) << 40;
+    const QRBoundingBox all(-RADIUS_MAX, REGION_X + RADIUS_MAX, -RADIUS_MAX, REGION_Y + RADIUS_MAX);
+
+    for(int update = 2; update >= 0; --update){
+        std::mt19937 gen(11);
+        QRTree tree{unbounded};
+        std::vector<Circle> objects;
+        std::vector<QRHandle> handles;
+        for(std::size_t i = 0; i < n; ++i){
+            objects.push_back(RandomCircle(gen));
+            handles.push_back(tree.InsertData(objects.back()));
+        }
+
+        const double t0 = Seconds();
+        for(std::size_t t = 0; t < ticks; ++t){
+            for(std::size_t i = 0; i < n; ++i){
+                Circle &cir = objects[i];
+                const Circle old = cir;
+                cir.x = std::min(std::max(cir.x + move(gen), 0.0), double(REGION_X));
+                cir.y = std::min(std::max(cir.y + move(gen), 0.0), double(REGION_Y));
+                if(update)
+                    tree.Update(handles[i], cir);
+                else{
+                    tree.Delete(QRBoundingBox(old.x - old.r, old.x + old.r, old.y - old.r, old.y + old.r));
+                    tree.InsertData(cir);
+                }
+            }
+            if(update == 2)
+                tree.CompactStep(n / 4);
+        }
+        const double t = Seconds() - t0;
+        // every handle outlives the steps of Compact
+        std::size_t lost = 0;
+        if(update)
+            for(auto &h: handles)
+                lost += !tree.Valid(h);
+
+        std::size_t left = 0;
+        tree.Query(all, [&left](const Circle &){
+            ++left;
+            return true;
+        });
+
+        const auto windows = RandomWindows(gen, 20000, 50);
+        std::size_t hits = 0;
+        const double q0 = Seconds();
+        for(auto &bb: windows)
+            tree.Query(bb, [&hits](const Circle &){
+                ++hits;
+                return true;
+            });
+        const double q = Seconds() - q0;
+
+        std::printf("moving %-14s n=%zu ticks=%zu step=%.1f  %10.0f moves/s  left=%zu lost=%zu  %10.0f queries/s\n",
+            update == 2 ? "update+compact" : update ? "update" : "delete+insert", n, ticks, step, n * ticks / t,
+            left, lost, windows.size() / q);
+        if(update != 1)
+            continue;
+
+        // the same circles inserted afresh, for the query speed to compare to
+        QRTree fresh{unbounded};
+        for(auto &cir: objects)
+            fresh.InsertData(cir);
+        const double f0 = Seconds();
+        for(auto &bb: windows)
+            fresh.Query(bb, [&hits](const Circle &){
+                ++hits;
+                return true;
+            });
+        std::printf("moving %-14s n=%zu  %10.0f queries/s\n", "fresh", n, windows.size() / (Seconds() - f0));
+    }
+}
+
+// build by n calls to InsertData against the bulk loader, then query each result
+static void BenchBulkLoad(std::size_t n){
+    std::mt19937 gen(2);
+    std::vector<Circle> data;
+    for(std::size_t i = 0; i < n; ++i)
+        data.push_back(RandomCircle(gen));
+    const auto windows = RandomWindows(gen, 1000, 100);
+
+    auto report = [&](const char *name, QRTree &tree, double build){
+        const double t0 = Seconds();
+        const std::size_t hits = QueryAll(tree, windows);
+        const double t = Seconds() - t0;
+        std::printf("bulkload %-8s n=%zu  build %8.3f s  %10.0f queries/s  hits=%zu\n",
+            name, n, build, windows.size() / t, hits);
+    };
+
+    {
+        double t0 = Seconds();
+        QRTree tree{n};
+        for(auto &cir: data)
+            tree.InsertData(cir);
+        report("insert", tree, Seconds() - t0);
+    }
+    for(auto packing: {QRPacking::STR, QRPacking::Hilbert}){
+        auto copy = data;
+        double t0 = Seconds();
+        QRTree tree{std::move(copy), n, packing};
+        report(packing == QRPacking::STR ? "str" : "hilbert", tree, Seconds() - t0);
+    }
+}
+
+// the same windows through every query form, on a packed tree of n circles
+static void BenchQueryApi(std::size_t n, double side){
+    std::mt19937 gen(3);
+    std::vector<Circle> data;
+    for(std::size_t i = 0; i < n; ++i)
+        data.push_back(RandomCircle(gen));
+    QRTree tree{std::move(data), n};
+    const auto windows = RandomWindows(gen, 2000, side);
+
+    auto run = [&](const char *name, std::size_t (*query)(QRTree&, const QRBoundingBox&)){
+        const std::size_t allocs = g_allocs;
+        const double t0 = Seconds();
+        std::size_t hits = 0;
+        for(auto &bb: windows)
+            hits += query(tree, bb);
+        const double t = Seconds() - t0;
+        std::printf("query %-8s n=%zu side=%-5.0f %10.0f queries/s  %8.3f allocs/query  hits=%zu\n",
+            name, n, side, windows.size() / t, double(g_allocs - allocs) / windows.size(), hits);
+    };
+
+    run("vector", [](QRTree &tree, const QRBoundingBox &bb){
+        auto res = tree.Query(bb);
+        const std::size_t n = res->size();
+        delete res;
+        return n;
+    });
+    run("visitor", [](QRTree &tree, const QRBoundingBox &bb){
+        std::size_t n = 0;
+        tree.Query(bb, [&n](const Circle &){
+            ++n;
+            return true;
+        });
+        return n;
+    });
+    run("iterator", [](QRTree &tree, const QRBoundingBox &bb){
+        std::size_t n = 0;
+        for(const Circle &cir: tree.Iterate(bb)){
+            (void)cir;
+            ++n;
+        }
+        return n;
+    });
+    run("buffer", [](QRTree &tree, const QRBoundingBox &bb){
+        static std::vector<Circle> out;
+        out.clear();
+        tree.Query(bb, out);
+        return out.size();
+    });
+}
+
+// k nearest circles by best-first search against re-querying ever larger boxes
+static void BenchNearest(std::size_t n, std::size_t k){
+    std::mt19937 gen(4);
+    std::vector<Circle> data;
+    for(std::size_t i = 0; i < n; ++i)
+        data.push_back(RandomCircle(gen));
+    QRTree tree{std::move(data), n};
+
+    std::uniform_real_distribution<double> px(0, REGION_X), py(0, REGION_Y);
+    std::vector<std::pair<double, double>> points;
+    for(std::size_t i = 0; i < 20000; ++i)
+        points.emplace_back(px(gen), py(gen));
+
+    double sum = 0;
+    double t0 = Seconds();
+    for(auto &p: points)
+        for(auto &nb: tree.Nearest(p.first, p.second, k))
+            sum += nb.dist;
+    double t = Seconds() - t0;
+    std::printf("nearest best-first k=%-3zu n=%zu %10.0f queries/s  sum=%.3f\n", k, n, points.size() / t, sum);
+
+    // the same into buffers kept across the queries, as the box search below keeps its own
+    std::vector<QRNeighbour> found;
+    QRTree::NearestQueue queue;
+    sum = 0;
+    t0 = Seconds();
+    for(auto &p: points){
+        found.clear();
+        tree.Nearest(p.first, p.second, k, found, queue);
+        for(auto &nb: found)
+            sum += nb.dist;
+    }
+    t = Seconds() - t0;
+    std::printf("nearest buffered k=%-3zu n=%zu %10.0f queries/s  sum=%.3f\n", k, n, points.size() / t, sum);
+
+    // a circle within R of the point overlaps the box of half side R around it, so once
+    // k circles are found within R they are the k nearest
+    std::vector<double> dists;
+    sum = 0;
+    t0 = Seconds();
+    for(auto &p: points){
+        for(double R = 16; ; R *= 2){
+            dists.clear();
+            QRBoundingBox bb{p.first - R, p.first + R, p.second - R, p.second + R};
+            tree.Query(bb, [&](const Circle &cir){
+                const double dx = cir.x - p.first, dy = cir.y - p.second;
+                const double d = std::max(0.0, std::sqrt(dx * dx + dy * dy) - cir.r);
+                if(d <= R)
+                    dists.push_back(d);
+                return true;
+            });
+            if(dists.size() >= k || R > 2 * (REGION_X + REGION_Y))
+                break;
+        }
+        const std::size_t m = std::min(k, dists.size());
+        std::partial_sort(dists.begin(), dists.begin() + m, dists.end());
+        for(std::size_t i = 0; i < m; ++i)
+            sum += dists[i];
+    }
+    t = Seconds() - t0;
+    std::printf("nearest box      k=%-3zu n=%zu %10.0f queries/s  sum=%.3f\n", k, n, points.size() / t, sum);
+}
+
+// bounding-square matching against the exact disc tests
+static void BenchRefine(std::size_t n, double side){
+    std::mt19937 gen(5);
+    std::vector<Circle> data;
+    for(std::size_t i = 0; i < n; ++i)
+        data.push_back(RandomCircle(gen));
+    QRTree tree{std::move(data), n};
+    const auto windows = RandomWindows(gen, 2000, side);
+
+    for(auto refine: {QRRefine::Box, QRRefine::Exact}){
+        std::size_t hits = 0;
+        const double t0 = Seconds();
+        for(auto &bb: windows)
+            tree.Query(bb, [&hits](const Circle &){
+                ++hits;
+                return true;
+            }, refine);
+        const double t = Seconds() - t0;
+        std::printf("refine %-6s n=%zu side=%-5.0f %10.0f queries/s  hits=%zu\n",
+            refine == QRRefine::Box ? "box" : "exact", n, side, windows.size() / t, hits);
+    }
+
+    std::size_t hits = 0;
+    const double t0 = Seconds();
+    for(auto &bb: windows){
+        Circle cir{};
+        cir.r = side / 2;
+        cir.x = bb.range[0].first + cir.r;
+        cir.y = bb.range[1].first + cir.r;
+        tree.QueryCircle(cir, [&hits](const Circle &){
+            ++hits;
+            return true;
+        });
+    }
+    const double t = Seconds() - t0;
+    std::printf("refine circle n=%zu r=%-8.0f %10.0f queries/s  hits=%zu\n", n, side / 2, windows.size() / t, hits);
+}
+
+static std::size_t VisitedNodes(const Innernode *inode, const QRBoundingBox &bb){
+    std::size_t n = 1;
+    if(!inode->leafchild)
+        for(auto i: inode->child)
+            if(i->overlaps(bb))
+                n += VisitedNodes(static_cast<const Innernode*>(i), bb);
+    return n;
+}
+
+// pointer nodes against the packed structure-of-arrays copy of the same tree
+static void BenchLayout(std::size_t n, double side){
+    std::mt19937 gen(6);
+    QRTree tree{n};
+    for(std::size_t i = 0; i < n; ++i)
+        tree.InsertData(RandomCircle(gen));
+    const auto packed = QRPackedTree::Pack(tree);
+    const auto windows = RandomWindows(gen, 5000, side);
+
+    std::size_t nodes = 0;
+    for(auto &bb: windows)
+        nodes += VisitedNodes(tree.Get_root(), bb);
+
+    auto run = [&](const char *name, const std::function<std::size_t(const QRBoundingBox&)> &query){
+        CacheMisses misses;
+        const long long m0 = misses.read();
+        const double t0 = Seconds();
+        std::size_t hits = 0;
+        for(auto &bb: windows)
+            hits += query(bb);
+        const double t = Seconds() - t0;
+        const long long m1 = misses.read();
+        std::printf("layout %-7s n=%zu side=%-5.0f %10.0f queries/s  %12.0f nodes/s  misses/query %s  hits=%zu\n",
+            name, n, side, windows.size() / t, nodes / t,
+            m0 < 0 ? "n/a" : std::to_string((m1 - m0) / (long long)windows.size()).c_str(), hits);
+    };
+
+    run("pointer", [&](const QRBoundingBox &bb){
+        std::size_t hits = 0;
+        tree.Query(bb, [&hits](const Circle &){
+            ++hits;
+            return true;
+        });
+        return hits;
+    });
+    run("packed", [&](const QRBoundingBox &bb){
+        std::size_t hits = 0;
+        packed->Query(bb, [&hits](const Circle &){
+            ++hits;
+            return true;
+        });
+        return hits;
+    });
+}
+
+// time from nothing to the answer of a first query: rebuilding by InsertData or by the
+// bulk loader against mapping a saved file, and what the first write then costs
+static void BenchWarmStart(std::size_t n, const char *path){
+    std::mt19937 gen(12);
+    std::vector<Circle> data;
+    for(std::size_t i = 0; i < n; ++i)
+        data.push_back(RandomCircle(gen));
+    const QRBoundingBox bb(1000, 1050, 1000, 1050);
+    auto first = [&bb](const auto &tree){
+        std::vector<Circle> out;
+        tree.Query(bb, out);
+        return out.size();
+    };
+
+    double t0 = Seconds();
+    QRTree tree{n};
+    for(auto &cir: data)
+        tree.InsertData(cir);
+    std::size_t hits = first(tree);
+    std::printf("warmstart %-8s n=%zu  %10.3f ms  hits=%zu\n", "insert", n, (Seconds() - t0) * 1e3, hits);
+
+    t0 = Seconds();
+    const QRTree bulk(std::vector<Circle>(data), n);
+    hits = first(bulk);
+    std::printf("warmstart %-8s n=%zu  %10.3f ms  hits=%zu\n", "bulkload", n, (Seconds() - t0) * 1e3, hits);
+
+    t0 = Seconds();
+    const auto packed = QRPackedTree::Pack(tree);
+    const bool saved = packed->Save(path);
+    std::printf("warmstart %-8s n=%zu  %10.3f ms  %zu bytes  %s\n", "save", n, (Seconds() - t0) * 1e3,
+        packed->Get_bytes(), saved ? path : "failed");
+    if(!saved)
+        return;
+
+    t0 = Seconds();
+    QRMappedTree mapped(path);
+    hits = first(mapped);
+    std::printf("warmstart %-8s n=%zu  %10.3f ms  hits=%zu\n", "open", n, (Seconds() - t0) * 1e3, hits);
+
+    t0 = Seconds();
+    mapped.InsertData(RandomCircle(gen));
+    std::printf("warmstart %-8s n=%zu  %10.3f ms  size=%zu\n", "thaw", n, (Seconds() - t0) * 1e3, mapped.Get_size());
+    std::remove(path);
+}
+
+// bytes held by the nodes of a tree, child vectors included
+template<typename Tree>
+static std::size_t NodeBytes(const typename Tree::Innernode *inode){
+    std::size_t n = sizeof(*inode) + inode->child.capacity() * sizeof(inode->child[0]);
+    for(auto i: inode->child)
+        n += inode->leafchild ? sizeof(typename Tree::Leafnode) : NodeBytes<Tree>(static_cast<const typename Tree::Innernode*>(i));
+    return n;
+}
+
+// the same discs indexed with float and with double coordinates
+template<typename Scalar>
+static void BenchScalarTree(const char *name, std::size_t n, double side){
+    typedef QRBasicTree<2, Scalar, QRBasicBall<2, Scalar>> Tree;
+    std::mt19937 gen(7);
+    Tree tree{n};
+    const double t0 = Seconds();
+    for(std::size_t i = 0; i < n; ++i){
+        const Circle c = RandomCircle(gen);
+        tree.InsertData(QRBasicBall<2, Scalar>{{Scalar(c.x), Scalar(c.y)}, Scalar(c.r)});
+    }
+    const double build = Seconds() - t0;
+
+    std::vector<typename Tree::Box> windows;
+    for(auto &bb: RandomWindows(gen, 5000, side))
+        windows.push_back(typename Tree::Box{bb.range[0].first, bb.range[0].second, bb.range[1].first, bb.range[1].second});
+
+    std::size_t hits = 0;
+    const double t1 = Seconds();
+    for(auto &bb: windows)
+        tree.Query(bb, [&hits](const QRBasicBall<2, Scalar> &){
+            ++hits;
+            return true;
+        });
+    const double t = Seconds() - t1;
+    std::printf("scalar %-6s n=%zu side=%-5.0f build %8.3f s  %10.0f queries/s  %8.1f bytes/entry  hits=%zu\n",
+        name, n, side, build, windows.size() / t, (double)NodeBytes<Tree>(tree.Get_root()) / n, hits);
+}
+
+// Walks a snapshot and checks what a torn or recycled node would break: every box
+// contains its children, all leaves are at one depth and match their payload, and
+// the count is the window. Returns the number of violations.
+static std::size_t CheckSnapshot(const Innernode *inode, int depth, int &leaf_depth, std::size_t &leaves){
+    std::size_t errors = 0;
+    for(auto i: inode->child){
+        if(!inode->contains(*i))
+            ++errors;
+        if(inode->leafchild){
+            const Leafnode *leaf = static_cast<const Leafnode*>(i);
+            const QRBoundingBox bb = QRPayloadTraits<2, double, Circle>::bounds(leaf->cir);
+            if(bb.range[0] != leaf->range[0] || bb.range[1] != leaf->range[1])
+                ++errors;
+            ++leaves;
+        }
+        else
+            errors += CheckSnapshot(static_cast<const Innernode*>(i), depth + 1, leaf_depth, leaves);
+    }
+    if(inode->leafchild){
+        if(leaf_depth < 0)
+            leaf_depth = depth;
+        else if(leaf_depth != depth)
+            ++errors;
+    }
+    return errors;
+}
+
+// one writer churns a concurrent tree while readers take snapshots and check them, false
+// if any snapshot was broken
+static bool BenchStress(std::size_t readers, double seconds){
+    const std::size_t window = 20000;
+    std::mt19937 gen(8);
+    QRTree tree{window};
+    for(std::size_t i = 0; i < window; ++i)
+        tree.InsertData(RandomCircle(gen));
+    tree.Set_concurrent(true);
+
+    std::atomic<bool> stop{false};
+    std::atomic<std::size_t> snapshots{0}, errors{0};
+    std::vector<std::thread> threads;
+    for(std::size_t r = 0; r < readers; ++r)
+        threads.emplace_back([&](){
+            while(!stop.load()){
+                auto snap = tree.Read();
+                int leaf_depth = -1;
+                std::size_t leaves = 0;
+                std::size_t e = CheckSnapshot(snap.Get_root(), 0, leaf_depth, leaves);
+                if(leaves != window)
+                    ++e;
+                errors += e;
+                ++snapshots;
+            }
+        });
+
+    std::size_t inserts = 0;
+    const double t0 = Seconds();
+    while(Seconds() - t0 < seconds){
+        for(int i = 0; i < 100; ++i)
+            tree.InsertData(RandomCircle(gen));
+        inserts += 100;
+    }
+    stop = true;
+    for(auto &t: threads)
+        t.join();
+
+    std::printf("stress readers=%zu seconds=%.0f inserts=%zu snapshots=%zu errors=%zu\n",
+        readers, seconds, inserts, snapshots.load(), errors.load());
+    return errors == 0;
+}
+
+// window queries from reader threads while one writer keeps inserting, readers either
+// share a mutex with the writer or read snapshots
+static void BenchConcurrent(std::size_t max_readers, double seconds){
+    const std::size_t n = 100000;
+    for(int rcu = 0; rcu < 2; ++rcu)
+        for(std::size_t readers = 1; readers <= max_readers; readers *= 2){
+            std::mt19937 gen(9);
+            QRTree tree{n};
+            for(std::size_t i = 0; i < n; ++i)
+                tree.InsertData(RandomCircle(gen));
+            if(rcu)
+                tree.Set_concurrent(true);
+
+            std::mutex lock;
+            std::atomic<bool> stop{false};
+            std::atomic<std::size_t> queries{0};
+            std::vector<std::thread> threads;
+            for(std::size_t r = 0; r < readers; ++r)
+                threads.emplace_back([&, r](){
+                    std::mt19937 rgen(100 + r);
+                    const auto windows = RandomWindows(rgen, 1000, 50);
+                    std::size_t done = 0, hits = 0;
+                    auto count = [&hits](const Circle &){
+                        ++hits;
+                        return true;
+                    };
+                    while(!stop.load(std::memory_order_relaxed)){
+                        const QRBoundingBox &bb = windows[done++ % windows.size()];
+                        if(rcu)
+                            tree.Read().Query(bb, count);
+                        else{
+                            std::lock_guard<std::mutex> guard(lock);
+                            tree.Query(bb, count);
+                        }
+                    }
+                    queries += done;
+                });
+
+            std::size_t inserts = 0;
+            const double t0 = Seconds();
+            while(Seconds() - t0 < seconds){
+                const Circle cir = RandomCircle(gen);
+                if(rcu)
+                    tree.InsertData(cir);
+                else{
+                    std::lock_guard<std::mutex> guard(lock);
+                    tree.InsertData(cir);
+                }
+                ++inserts;
+            }
+            stop = true;
+            for(auto &t: threads)
+                t.join();
+            const double t = Seconds() - t0;
+
+            std::printf("concurrent %-5s readers=%-3zu %10.0f queries/s  %10.0f inserts/s\n",
+                rcu ? "rcu" : "mutex", readers, queries.load() / t, inserts / t);
+        }
+}
+
+// one batch of window queries per frame, first one by one on this thread, then through
+// QueryBatch on pools of 1 .. max_threads threads, each alone and grouped
+static void BenchBatch(std::size_t n, std::size_t batch, std::size_t max_threads){
+    std::mt19937 gen(10);
+    std::vector<Circle> data;
+    for(std::size_t i = 0; i < n; ++i)
+        data.push_back(RandomCircle(gen));
+    const QRTree tree(std::move(data), n);
+    const auto windows = RandomWindows(gen, batch, 50);
+    const int frames = 20;
+
+    std::vector<Circle> out;
+    std::size_t expect = 0;
+    double t0 = Seconds();
+    for(int f = 0; f < frames; ++f){
+        expect = 0;
+        for(auto &bb: windows){
+            out.clear();
+            tree.Query(bb, out);
+            expect += out.size();
+        }
+    }
+    const double base = frames * batch / (Seconds() - t0);
+    std::printf("batch sequential          %10.0f queries/s  hits=%zu\n", base, expect);
+
+    for(int group = 0; group < 2; ++group)
+        for(std::size_t threads = 1; threads <= max_threads; threads *= 2){
+            QRThreadPool pool(threads);
+            QRBatchResult result;
+            // the first frames grow the buffers
+            for(int f = 0; f < 2; ++f)
+                tree.QueryBatch(windows, result, pool, group);
+
+            const std::size_t allocs = g_allocs.load();
+            t0 = Seconds();
+            for(int f = 0; f < frames; ++f)
+                tree.QueryBatch(windows, result, pool, group);
+            const double qps = frames * batch / (Seconds() - t0);
+
+            std::printf("batch %-7s threads=%-3zu %10.0f queries/s  x%.2f  hits=%zu  allocs/frame=%.1f\n",
+                group ? "grouped" : "single", threads, qps, qps / base, result.hits.size(),
+                double(g_allocs.load() - allocs) / frames);
+        }
+}
+
+// Data sets of the suite: uniform, Gaussian clusters, skewed radii with a long tail, and
+// circles that all overlap each other around the middle of the region
+static Circle SuiteCircle(const std::string &dist, std::mt19937 &gen){
+    if(dist == "clustered"){
+        static std::vector<std::pair<double, double>> centres;
+        if(centres.empty()){
+            std::mt19937 fixed(13);
+            for(int i = 0; i < 16; ++i)
+                centres.emplace_back(RandomCircle(fixed).x, RandomCircle(fixed).y);
+        }
+        const auto &c = centres[gen() % centres.size()];
+        std::normal_distribution<double> x(c.first, 40), y(c.second, 40);
+        std::uniform_real_distribution<double> r(0, RADIUS_MAX);
+        Circle cir{};
+        cir.x = std::min(std::max(x(gen), 0.0), double(REGION_X));
+        cir.y = std::min(std::max(y(gen), 0.0), double(REGION_Y));
+        cir.r = r(gen);
+        return cir;
+    }
+    if(dist == "skewed"){
+        std::exponential_distribution<double> r(0.5);
+        Circle cir = RandomCircle(gen);
+        cir.r = std::min(r(gen), 10.0 * RADIUS_MAX);
+        return cir;
+    }
+    if(dist == "overlapped"){
+        std::normal_distribution<double> x(REGION_X / 2, 5), y(REGION_Y / 2, 5);
+        std::uniform_real_distribution<double> r(100, 200);
+        Circle cir{};
+        cir.x = x(gen);
+        cir.y = y(gen);
+        cir.r = r(gen);
+        return cir;
+    }
+    return RandomCircle(gen);
+}
+
+// JSON report of the suite, one object per workload. hits counts the query results, or
+// the payloads a delete removed
+struct SuiteReport{
+    bool first = true;
+
+    void add(const char *workload, const std::string &dist, int min_child, int max_child, const char *param,
+        double value, std::vector<double> &ns, double seconds, std::size_t hits){
+        std::sort(ns.begin(), ns.end());
+        auto at = [&ns](double q){return ns.empty() ? 0.0 : ns[std::min(ns.size() - 1, std::size_t(q * ns.size()))];};
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+
+        std::printf("%s\n    {\"workload\": \"%s\", \"dist\": \"%s\", \"min_child\": %d, \"max_child\": %d, "
+            "\"%s\": %g, \"ops\": %zu, \"ops_per_sec\": %.0f, \"p50_ns\": %.0f, \"p99_ns\": %.0f, "
+            "\"hits\": %zu, \"peak_rss_kb\": %ld}",
+            first ? "" : ",", workload, dist.c_str(), min_child, max_child, param, value, ns.size(),
+            ns.size() / seconds, at(0.5), at(0.99), hits, usage.ru_maxrss);
+        first = false;
+    }
+};
+
+// One Delete of a square in the middle of the region holding share of the n circles, on a
+// tree of its own each, then the query rate of what is left
+static void BenchDelete(std::size_t n){
+    for(double share: {0.01, 0.05, 0.1, 0.25, 0.5}){
+        std::mt19937 gen(19);
+        QRTree tree{n};
+        for(std::size_t i = 0; i < n; ++i)
+            tree.InsertData(RandomCircle(gen));
+        const auto windows = RandomWindows(gen, 2000, 50);
+
+        const double half = std::sqrt(share * REGION_X * REGION_Y) / 2;
+        const QRBoundingBox region(REGION_X / 2 - half, REGION_X / 2 + half, REGION_Y / 2 - half, REGION_Y / 2 + half);
+        const double t0 = Seconds();
+        tree.Delete(region);
+        const double t = Seconds() - t0;
+
+        std::size_t left = 0;
+        tree.Query(QRBoundingBox(-1e9, 1e9, -1e9, 1e9), [&left](const Circle &){
+            ++left;
+            return true;
+        });
+        const double q0 = Seconds();
+        for(auto &bb: windows)
+            tree.Query(bb, [](const Circle &){return true;});
+        const double q = Seconds() - q0;
+
+        std::printf("delete share=%-5.2f n=%zu  %10.3f ms  removed=%zu size=%zu  after: %8.0f queries/s\n",
+            share, n, t * 1e3, n - left, tree.Get_size(), windows.size() / q);
+    }
+}
+
+// Collision pass over n circles: one Query of the box of every circle, as done so far, the
+// same through QueryCircle, then SelfJoin alone and on the pool. Pairs are counted once
+static void BenchJoin(std::size_t n, std::size_t max_threads){
+    std::mt19937 gen(18);
+    std::vector<Circle> data;
+    for(std::size_t i = 0; i < n; ++i)
+        data.push_back(RandomCircle(gen));
+    QRTree tree{n};
+    for(auto &cir: data)
+        tree.InsertData(cir);
+
+    // every circle meets itself and both ends of each pair meet
+    std::size_t hits = 0;
+    double t0 = Seconds();
+    for(auto &cir: data){
+        auto res = tree.Query(QRBoundingBox(cir.x - cir.r, cir.x + cir.r, cir.y - cir.r, cir.y + cir.r));
+        for(auto &leaf: *res)
+            hits += DiscOverlapsDisc(leaf.cir, cir);
+        delete res;
+    }
+    const double base = Seconds() - t0;
+    std::printf("join query loop    %8.3f s  pairs=%zu\n", base, (hits - n) / 2);
+
+    hits = 0;
+    t0 = Seconds();
+    for(auto &cir: data)
+        tree.QueryCircle(cir, [&hits](const Circle &){
+            ++hits;
+            return true;
+        });
+    double t = Seconds() - t0;
+    std::printf("join circle loop   %8.3f s  x%.2f  pairs=%zu\n", t, base / t, (hits - n) / 2);
+
+    std::size_t pairs = 0;
+    t0 = Seconds();
+    tree.SelfJoin([&pairs](const Circle &, const Circle &){
+        ++pairs;
+        return true;
+    });
+    t = Seconds() - t0;
+    std::printf("join self          %8.3f s  x%.2f  pairs=%zu\n", t, base / t, pairs);
+
+    for(std::size_t threads = 1; threads <= max_threads; threads *= 2){
+        QRThreadPool pool(threads);
+        std::vector<std::size_t> counts(threads * 8, 0);
+        t0 = Seconds();
+        tree.SelfJoin([&counts](const Circle &, const Circle &, unsigned thread){
+            ++counts[thread * 8];
+        }, pool);
+        t = Seconds() - t0;
+        pairs = 0;
+        for(auto c: counts)
+            pairs += c;
+        std::printf("join self threads=%-3zu %8.3f s  x%.2f  pairs=%zu\n", threads, t, base / t, pairs);
+    }
+}
+
+// Dashboard windows of growing side over n circles: count and area summed from the hits of
+// Query into a vector, then by Aggregate
+static void BenchAggregate(std::size_t n){
+    std::mt19937 gen(20);
+    QRTree tree{n};
+    for(std::size_t i = 0; i < n; ++i)
+        tree.InsertData(RandomCircle(gen));
+
+    std::vector<Circle> out;
+    for(double side: {50.0, 200.0, 800.0, 2000.0}){
+        const auto windows = RandomWindows(gen, 200, side);
+        std::size_t count = 0;
+        double area = 0;
+        double t0 = Seconds();
+        for(auto &bb: windows){
+            out.clear();
+            tree.Query(bb, out);
+            count += out.size();
+            for(auto &cir: out)
+                area += M_PI * cir.r * cir.r;
+        }
+        const double base = Seconds() - t0;
+
+        QRSummary sum;
+        t0 = Seconds();
+        for(auto &bb: windows)
+            sum.add(tree.Aggregate(bb));
+        const double t = Seconds() - t0;
+        std::printf("aggregate side=%-6.0f query %10.0f /s  aggregate %10.0f /s  x%.1f  count=%zu/%zu area=%.6g/%.6g\n",
+            side, windows.size() / base, windows.size() / t, base / t, count, sum.count, area, sum.sum_area);
+    }
+}
+
+// Windows over a tree churned through two generations of n circles, asking for those
+// inserted last: everything in the window by Query, then only the last ones by stamp
+static void BenchRecent(std::size_t n){
+    std::mt19937 gen(24);
+    QRTree tree{n};
+    for(std::size_t i = 0; i < 2 * n; ++i)
+        tree.InsertData(RandomCircle(gen));
+    const auto windows = RandomWindows(gen, 1000, 400);
+
+    std::vector<Circle> out;
+    std::size_t all = 0;
+    double t0 = Seconds();
+    for(auto &bb: windows){
+        out.clear();
+        tree.Query(bb, out);
+        all += out.size();
+    }
+    const double base = Seconds() - t0;
+
+    for(std::size_t last: {n / 1000, n / 100, n / 10, n}){
+        tree.ResetStats();
+        std::size_t hits = 0;
+        t0 = Seconds();
+        for(auto &bb: windows){
+            out.clear();
+            tree.Query(bb, tree.Get_stamp() - last + 1, tree.Get_stamp(), out);
+            hits += out.size();
+        }
+        const double t = Seconds() - t0;
+        const auto counters = tree.Get_counters();
+        std::printf("recent last=%-8zu query %10.0f /s  by stamp %10.0f /s  x%.1f  hits=%zu/%zu visited/query=%6.1f\n",
+            last, windows.size() / base, windows.size() / t, base / t, hits, all,
+            double(counters.visited) / windows.size());
+    }
+}
+
+// Density rasters of the whole region over n circles: Query and bin every hit by its
+// centre, then Rasterize, then Rasterize in bands across up to max threads
+static void BenchRaster(std::size_t n, std::size_t max_threads){
+    std::mt19937 gen(25);
+    QRTree tree{n};
+    for(std::size_t i = 0; i < n; ++i)
+        tree.InsertData(RandomCircle(gen));
+    QRBoundingBox bb;
+    bb.range[0] = {0, REGION_X};
+    bb.range[1] = {0, REGION_Y};
+
+    std::vector<Circle> hits;
+    std::vector<std::uint32_t> raster;
+    for(std::size_t side: {16, 64, 256, 1024}){
+        const int frames = 5;
+        std::vector<std::uint32_t> binned(side * side);
+        double t0 = Seconds();
+        for(int f = 0; f < frames; ++f){
+            hits.clear();
+            tree.Query(bb, hits);
+            std::fill(binned.begin(), binned.end(), 0);
+            // by the centre of the box, as Rasterize takes it
+            for(auto &cir: hits){
+                const double cx = ((cir.x - cir.r) + (cir.x + cir.r)) / 2, cy = ((cir.y - cir.r) + (cir.y + cir.r)) / 2;
+                if(cx < 0 || cx > REGION_X || cy < 0 || cy > REGION_Y)
+                    continue;
+                const std::size_t x = std::min(side - 1, std::size_t(cx * (double(side) / REGION_X)));
+                const std::size_t y = std::min(side - 1, std::size_t(cy * (double(side) / REGION_Y)));
+                ++binned[y * side + x];
+            }
+        }
+        const double base = (Seconds() - t0) / frames;
+
+        tree.ResetStats();
+        t0 = Seconds();
+        for(int f = 0; f < frames; ++f)
+            tree.Rasterize(bb, side, side, raster);
+        const double t = (Seconds() - t0) / frames;
+        const auto counters = tree.Get_counters();
+        std::printf("raster %4zux%-4zu query+bin %8.2f ms  rasterize %8.2f ms  x%.1f  visited=%zu%s\n",
+            side, side, base * 1e3, t * 1e3, base / t, counters.visited / frames, raster == binned ? "" : "  MISMATCH");
+
+        for(std::size_t threads = 1; threads <= max_threads; threads *= 2){
+            QRThreadPool pool(threads);
+            t0 = Seconds();
+            for(int f = 0; f < frames; ++f)
+                tree.Rasterize(bb, side, side, raster, pool);
+            const double tp = (Seconds() - t0) / frames;
+            std::printf("raster %4zux%-4zu threads=%-3zu %8.2f ms  x%.1f%s\n",
+                side, side, threads, tp * 1e3, base / tp, raster == binned ? "" : "  MISMATCH");
+        }
+    }
+}
+
+// Query rate of a tree churned through several generations of n circles, then after
+// Compact, and the longest of the bounded steps of an incremental one
+static void BenchCompact(std::size_t n, std::size_t generations){
+    std::mt19937 gen(21);
+    QRTree tree{n};
+    for(std::size_t i = 0; i < n * generations; ++i)
+        tree.InsertData(RandomCircle(gen));
+    const auto windows = RandomWindows(gen, 20000, 20);
+    auto rate = [&tree, &windows](){
+        std::size_t hits = 0;
+        const double t0 = Seconds();
+        for(auto &bb: windows)
+            tree.Query(bb, [&hits](const Circle &){
+                ++hits;
+                return true;
+            });
+        return windows.size() / (Seconds() - t0);
+    };
+
+    const double before = rate();
+    double t0 = Seconds();
+    tree.Compact();
+    const double t = Seconds() - t0;
+    const double after = rate();
+    std::printf("compact n=%zu generations=%zu  %8.3f ms  before %10.0f queries/s  after %10.0f queries/s  x%.2f\n",
+        n, generations, t * 1e3, before, after, after / before);
+
+    // churn again, then compact 1000 nodes per step between inserts
+    for(std::size_t i = 0; i < n * generations; ++i)
+        tree.InsertData(RandomCircle(gen));
+    std::size_t steps = 0;
+    double longest = 0, total = 0;
+    for(bool done = false; !done; ++steps){
+        t0 = Seconds();
+        done = tree.CompactStep(1000);
+        longest = std::max(longest, Seconds() - t0);
+        total += Seconds() - t0;
+        tree.InsertData(RandomCircle(gen));
+    }
+    std::printf("compact steps=%zu  total %8.3f ms  longest step %8.3f ms  after %10.0f queries/s\n",
+        steps, total * 1e3, longest * 1e3, rate());
+}
+
+// Insert rate against the query rate and overlap of the tree it builds, for each split
+// and choose-subtree strategy, on n uniform circles and on as many in clusters
+static void BenchStrategy(std::size_t n){
+    const std::pair<QRSplit, const char*> splits[] = {
+        {QRSplit::RStar, "rstar"}, {QRSplit::Quadratic, "quadratic"}, {QRSplit::Linear, "linear"}};
+    const std::pair<QRChoose, const char*> chooses[] = {
+        {QRChoose::RStar, "rstar"}, {QRChoose::Revised, "revised"}, {QRChoose::Area, "area"}};
+
+    for(const char *dist: {"uniform", "clustered"}){
+        std::mt19937 gen(22);
+        std::vector<Circle> data;
+        for(std::size_t i = 0; i < n; ++i)
+            data.push_back(SuiteCircle(dist, gen));
+        const auto windows = RandomWindows(gen, 20000, 20);
+
+        for(auto &split: splits)
+            for(auto &choose: chooses){
+                QRTree tree{n};
+                tree.Set_strategy(split.first, choose.first);
+                double t0 = Seconds();
+                for(auto &cir: data)
+                    tree.InsertData(cir);
+                const double insert = Seconds() - t0;
+
+                std::size_t hits = 0;
+                t0 = Seconds();
+                for(auto &bb: windows)
+                    tree.Query(bb, [&hits](const Circle &){
+                        ++hits;
+                        return true;
+                    });
+                const double query = Seconds() - t0;
+                const auto stats = tree.Stats();
+                std::printf("strategy %-9s split=%-9s choose=%-7s %10.0f inserts/s %10.0f queries/s  visited/query=%5.1f overlap=%.4g\n",
+                    dist, split.second, choose.second, n / insert, windows.size() / query,
+                    double(stats.counters.visited) / stats.counters.queries, stats.total_overlap);
+            }
+    }
+}
+
+// Polygon, corridor and ray queries against what a caller did before: query the bounding
+// box of the shape and filter the candidates, for the ray the box of its first maxdist
+static void BenchShapes(std::size_t n, std::size_t queries){
+    typedef QRPayloadTraits<2, double, Circle> Traits;
+    std::mt19937 gen(23);
+    QRTree tree{n};
+    for(std::size_t i = 0; i < n; ++i)
+        tree.InsertData(RandomCircle(gen));
+    std::uniform_real_distribution<double> x(0, REGION_X), y(0, REGION_Y), angle(0, 2 * M_PI);
+
+    // stars of 10 corners, radii 40 and 160, corridors of width 4 and 200 long, rays of 500
+    std::vector<QRPolygon> polygons;
+    std::vector<QRBasicSegment<double>> corridors;
+    std::vector<std::array<double, 4>> rays;
+    for(std::size_t q = 0; q < queries; ++q){
+        const double cx = x(gen), cy = y(gen), turn = angle(gen);
+        std::vector<std::array<double, 2>> corners;
+        for(int i = 0; i < 10; ++i){
+            const double a = turn + i * M_PI / 5, r = i % 2 ? 40 : 160;
+            corners.push_back({{cx + r * std::cos(a), cy + r * std::sin(a)}});
+        }
+        polygons.emplace_back(std::move(corners));
+        corridors.push_back(QRBasicSegment<double>{cx, cy, cx + 200 * std::cos(turn), cy + 200 * std::sin(turn), 2});
+        rays.push_back({{cx, cy, std::cos(turn), std::sin(turn)}});
+    }
+
+    auto report = [&](const char *what, const std::function<std::size_t(std::size_t)> &shape,
+        const std::function<std::size_t(std::size_t)> &filtered){
+        tree.ResetStats();
+        double t0 = Seconds();
+        std::size_t a = 0;
+        for(std::size_t q = 0; q < queries; ++q)
+            a += shape(q);
+        const double ts = Seconds() - t0;
+        const auto counters = tree.Get_counters();
+        t0 = Seconds();
+        std::size_t b = 0;
+        for(std::size_t q = 0; q < queries; ++q)
+            b += filtered(q);
+        const double tf = Seconds() - t0;
+        std::printf("shapes %-8s %10.0f queries/s  box+filter %10.0f queries/s  visited/query=%6.1f tested/query=%7.1f%s\n",
+            what, queries / ts, queries / tf, double(counters.visited) / queries, double(counters.tested) / queries,
+            a == b ? "" : "  MISMATCH");
+    };
+
+    std::vector<Circle> out;
+    report("polygon", [&](std::size_t q){
+        out.clear();
+        tree.QueryPolygon(polygons[q], out);
+        return out.size();
+    }, [&](std::size_t q){
+        std::size_t hits = 0;
+        tree.Query(polygons[q].bound, [&](const Circle &cir){
+            hits += Traits::overlaps(cir, polygons[q]);
+            return true;
+        });
+        return hits;
+    });
+    report("segment", [&](std::size_t q){
+        out.clear();
+        const auto &c = corridors[q];
+        tree.QuerySegment(c.x0, c.y0, c.x1, c.y1, 2 * c.r, out);
+        return out.size();
+    }, [&](std::size_t q){
+        std::size_t hits = 0;
+        tree.Query(corridors[q].bounds(), [&](const Circle &cir){
+            hits += Traits::overlaps(cir, corridors[q]);
+            return true;
+        });
+        return hits;
+    });
+    const double reach = 500;
+    report("raycast", [&](std::size_t q){
+        QRNeighbour hit;
+        return tree.Raycast(rays[q][0], rays[q][1], rays[q][2], rays[q][3], hit, reach) ? std::size_t(hit.dist * 1e6) : 0;
+    }, [&](std::size_t q){
+        const auto &ray = rays[q];
+        const double origin[2] = {ray[0], ray[1]}, dir[2] = {ray[2], ray[3]};
+        double nearest = std::numeric_limits<double>::infinity();
+        const double ex = ray[0] + reach * ray[2], ey = ray[1] + reach * ray[3];
+        tree.Query(QRBoundingBox(std::min(ray[0], ex), std::max(ray[0], ex), std::min(ray[1], ey), std::max(ray[1], ey)),
+            [&](const Circle &cir){
+                nearest = std::min(nearest, Traits::rayEntry(cir, origin, dir));
+                return true;
+            });
+        return nearest <= reach ? std::size_t(nearest * 1e6) : 0;
+    });
+}
+
+static bool SameCircle(const Circle &a, const Circle &b){
+    return a.x == b.x && a.y == b.y && a.r == b.r;
+}
+
+// One random write of the mixes the checks below run: an insert, which may expire the
+// front, a region Delete by box or exactly, an Update through a handle, or some Compact
+static void MixedWrite(QRTree &tree, std::vector<QRHandle> &handles, std::mt19937 &gen){
+    std::uniform_real_distribution<double> x(0, REGION_X), y(0, REGION_Y), step(-30, 30);
+    const unsigned op = gen() % 100;
+    if(op < 60)
+        handles.push_back(tree.InsertData(RandomCircle(gen)));
+    else if(op < 64){
+        const double x0 = x(gen), y0 = y(gen);
+        tree.Delete(QRBoundingBox(x0, x0 + 60, y0, y0 + 60), gen() % 2 ? QRRefine::Exact : QRRefine::Box);
+    }
+    else if(op < 97){
+        QRHandle &h = handles[gen() % handles.size()];
+        if(const Circle *at = tree.Get(h)){
+            Circle cir = *at;
+            cir.x = std::min(std::max(cir.x + step(gen), 0.0), double(REGION_X));
+            cir.y = std::min(std::max(cir.y + step(gen), 0.0), double(REGION_Y));
+            // one held in a corner stays put, which would report Left and Entered of the same
+            if(!SameCircle(cir, *at))
+                tree.Update(h, cir);
+        }
+    }
+    else if(op < 99)
+        tree.CompactStep(200);
+    else
+        tree.Compact();
+}
+
+static void SortCircles(std::vector<Circle> &v){
+    std::sort(v.begin(), v.end(), [](const Circle &a, const Circle &b){
+        return a.x != b.x ? a.x < b.x : a.y != b.y ? a.y < b.y : a.r < b.r;
+    });
+}
+
+static bool SameCircles(std::vector<Circle> a, std::vector<Circle> b){
+    SortCircles(a);
+    SortCircles(b);
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), SameCircle);
+}
+
+// The events of subscriptions against Query before and after every one of steps mixed
+// writes: each window has to hear of exactly what entered and left it, so neither a
+// payload missed nor one reported while it stayed put, as across a reinsert or split
+static bool CheckSubscribe(std::size_t steps){
+    std::mt19937 gen(24);
+    QRTree tree{2000, 2, 4, 10};
+    std::vector<QRHandle> handles;
+    for(std::size_t i = 0; i < 2000; ++i)
+        handles.push_back(tree.InsertData(RandomCircle(gen)));
+
+    std::vector<QRBoundingBox> windows;
+    for(double side: {20, 60, 200, 600})
+        for(auto &bb: RandomWindows(gen, 4, side))
+            windows.push_back(bb);
+    const auto refineOf = [](std::size_t w){return w % 2 ? QRRefine::Exact : QRRefine::Box;};
+    std::vector<std::vector<Circle>> entered(windows.size()), left(windows.size()), before(windows.size());
+    for(std::size_t w = 0; w < windows.size(); ++w)
+        tree.Subscribe(windows[w], [&entered, &left, w](const Circle &cir, QREvent event){
+            (event == QREvent::Entered ? entered : left)[w].push_back(cir);
+        }, refineOf(w));
+
+    const auto less = [](const Circle &a, const Circle &b){
+        return a.x != b.x ? a.x < b.x : a.y != b.y ? a.y < b.y : a.r < b.r;
+    };
+    std::size_t wrong = 0, events = 0;
+    std::vector<Circle> after, in, out;
+    for(std::size_t i = 0; i <= steps; ++i){
+        if(i > 0)
+            MixedWrite(tree, handles, gen);
+        for(std::size_t w = 0; w < windows.size(); ++w){
+            after.clear();
+            tree.Query(windows[w], after, refineOf(w));
+            SortCircles(after);
+            in.clear();
+            out.clear();
+            std::set_difference(after.begin(), after.end(), before[w].begin(), before[w].end(), std::back_inserter(in), less);
+            std::set_difference(before[w].begin(), before[w].end(), after.begin(), after.end(), std::back_inserter(out), less);
+            wrong += !SameCircles(entered[w], in) || !SameCircles(left[w], out);
+            events += entered[w].size() + left[w].size();
+            entered[w].clear();
+            left[w].clear();
+            before[w].swap(after);
+        }
+    }
+    std::printf("subscribe check steps=%zu windows=%zu  events=%zu  wrong=%zu\n", steps, windows.size(), events, wrong);
+    return wrong == 0 && events > 0;
+}
+
+// Viewports kept up to date while inserts churn the FIFO: re-querying every viewport each
+// frame against standing queries that hear of the changes alone. Times whole frames, and
+// the inserts of a frame without either
+static bool BenchSubscribe(std::size_t n, std::size_t viewports, std::size_t frames){
+    if(!CheckSubscribe(2000)){
+        std::printf("subscribe FAILED: events differ from Query\n");
+        return false;
+    }
+    for(std::size_t churn: {1, 10, 100, 1000}){
+        std::mt19937 gen(22);
+        QRTree bare{n}, polled{n}, pushed{n};
+        for(std::size_t i = 0; i < n; ++i){
+            const Circle cir = RandomCircle(gen);
+            bare.InsertData(cir);
+            polled.InsertData(cir);
+            pushed.InsertData(cir);
+        }
+        const auto windows = RandomWindows(gen, viewports, 50);
+        std::vector<Circle> inserts;
+        for(std::size_t i = 0; i < churn * frames; ++i)
+            inserts.push_back(RandomCircle(gen));
+
+        // what each viewport shows, as a count
+        std::vector<std::size_t> shown(windows.size());
+        std::size_t events = 0;
+        for(std::size_t w = 0; w < windows.size(); ++w)
+            pushed.Subscribe(windows[w], [&shown, &events, w](const Circle &, QREvent event){
+                if(event == QREvent::Entered)
+                    ++shown[w];
+                else
+                    --shown[w];
+                ++events;
+            });
+        events = 0;
+
+        double t0 = Seconds();
+        for(std::size_t f = 0; f < frames; ++f)
+            for(std::size_t i = 0; i < churn; ++i)
+                bare.InsertData(inserts[f * churn + i]);
+        const double alone = (Seconds() - t0) / frames;
+
+        std::vector<Circle> out;
+        std::size_t polled_shown = 0;
+        t0 = Seconds();
+        for(std::size_t f = 0; f < frames; ++f){
+            for(std::size_t i = 0; i < churn; ++i)
+                polled.InsertData(inserts[f * churn + i]);
+            polled_shown = 0;
+            for(auto &bb: windows){
+                out.clear();
+                polled.Query(bb, out);
+                polled_shown += out.size();
+            }
+        }
+        const double poll = (Seconds() - t0) / frames;
+
+        t0 = Seconds();
+        for(std::size_t f = 0; f < frames; ++f)
+            for(std::size_t i = 0; i < churn; ++i)
+                pushed.InsertData(inserts[f * churn + i]);
+        const double push = (Seconds() - t0) / frames;
+
+        std::size_t pushed_shown = 0;
+        for(auto k: shown)
+            pushed_shown += k;
+        std::printf("subscribe churn=%4zu/frame viewports=%zu  inserts alone %8.1f  requery %8.1f  subscribed %8.1f us/frame  %6.1f events/frame%s\n",
+            churn, windows.size(), alone * 1e6, poll * 1e6, push * 1e6, double(events) / frames,
+            polled_shown == pushed_shown ? "" : "  MISMATCH");
+    }
+    return true;
+}
+
+// CachedQuery against Query after every one of steps mixed writes, on both refines, with
+// a cache large enough to keep everything and one that keeps evicting
+static bool CheckCache(std::size_t steps){
+    bool ok = true;
+    for(std::size_t bytes: {std::size_t(64) << 20, std::size_t(96) << 10}){
+        std::mt19937 gen(23);
+        QRTree tree{2000};
+        std::vector<QRHandle> handles;
+        for(std::size_t i = 0; i < 2000; ++i)
+            handles.push_back(tree.InsertData(RandomCircle(gen)));
+        tree.Set_query_cache(bytes);
+        std::vector<QRBoundingBox> windows;
+        for(double side: {20, 60, 200, 600})
+            for(auto &bb: RandomWindows(gen, 8, side))
+                windows.push_back(bb);
+
+        std::vector<Circle> cached, plain;
+        std::size_t wrong = 0;
+        for(std::size_t i = 0; i < steps; ++i){
+            MixedWrite(tree, handles, gen);
+            // in no fixed order, so that the small cache hits some while it evicts
+            for(std::size_t j = 0; j < 16; ++j){
+                const QRBoundingBox &bb = windows[gen() % windows.size()];
+                const QRRefine refine = gen() % 2 ? QRRefine::Exact : QRRefine::Box;
+                cached.clear();
+                plain.clear();
+                tree.CachedQuery(bb, cached, refine);
+                tree.Query(bb, plain, refine);
+                wrong += !SameCircles(cached, plain);
+            }
+        }
+        const auto counters = tree.Get_counters();
+        std::printf("cache check bytes=%zu steps=%zu  hits=%llu misses=%llu  wrong=%zu\n", bytes, steps,
+            (unsigned long long)counters.cache_hits, (unsigned long long)counters.cache_misses, wrong);
+        // a cache that never hits checks nothing
+        if(wrong || counters.cache_hits == 0)
+            ok = false;
+    }
+    return ok;
+}
+
+// Viewport polling: the same windows queried every frame while a few inserts per frame
+// churn the FIFO, through Query and through CachedQuery, with the hit rate of the cache
+static bool BenchCache(std::size_t n, std::size_t viewports, std::size_t frames){
+    if(!CheckCache(2000)){
+        std::printf("cache FAILED: CachedQuery differs from Query\n");
+        return false;
+    }
+    for(std::size_t churn: {0, 1, 10, 100, 1000}){
+        std::mt19937 gen(21);
+        QRTree plain{n}, cached{n};
+        for(std::size_t i = 0; i < n; ++i){
+            const Circle cir = RandomCircle(gen);
+            plain.InsertData(cir);
+            cached.InsertData(cir);
+        }
+        cached.Set_query_cache(64 << 20);
+        const auto windows = RandomWindows(gen, viewports, 50);
+        std::vector<Circle> inserts;
+        for(std::size_t i = 0; i < churn * frames; ++i)
+            inserts.push_back(RandomCircle(gen));
+
+        std::vector<Circle> out;
+        auto run = [&](QRTree &tree, bool cache){
+            double querying = 0;
+            std::size_t hits = 0;
+            for(std::size_t f = 0; f < frames; ++f){
+                for(std::size_t i = 0; i < churn; ++i)
+                    tree.InsertData(inserts[f * churn + i]);
+                const double t0 = Seconds();
+                for(auto &bb: windows){
+                    out.clear();
+                    if(cache)
+                        tree.CachedQuery(bb, out);
+                    else
+                        tree.Query(bb, out);
+                    hits += out.size();
+                }
+                querying += Seconds() - t0;
+            }
+            return std::make_pair(frames * windows.size() / querying, hits);
+        };
+        const auto a = run(plain, false);
+        const auto b = run(cached, true);
+        const auto counters = cached.Get_counters();
+        std::printf("cache churn=%4zu/frame viewports=%zu  query %10.0f queries/s  cached %10.0f queries/s  hit rate %5.1f%%%s\n",
+            churn, windows.size(), a.first, b.first,
+            100.0 * counters.cache_hits / (counters.cache_hits + counters.cache_misses),
+            a.second == b.second ? "" : "  MISMATCH");
+    }
+    return true;
+}
+
+// Insert rate as writer threads scale, one tree behind a lock against a sharded tree cut by
+// Rebalance from a first tenth of the data, then each writer inserting its share of the rest.
+// Then the skew of the data over even cuts, the cost of a Rebalance and the query rate
+static bool BenchSharded(std::size_t n, std::size_t shards, std::size_t max_threads){
+    const QRBoundingBox bound(0, REGION_X, 0, REGION_Y);
+    bool ok = true;
+
+    // centres tied on a few integer points, and a window that is no multiple of the shards:
+    // Rebalance has to split the ties across the cuts and keep every circle
+    {
+        std::mt19937 gen(20);
+        std::uniform_int_distribution<int> at(0, 3);
+        QRShardedTree tied(QRBoundingBox(0, 3, 0, 3), shards, 8003);
+        for(std::size_t i = 0; i < 6000; ++i){
+            Circle cir{};
+            cir.x = at(gen);
+            cir.y = at(gen);
+            cir.r = 0.5;
+            tied.InsertData(cir);
+        }
+        const std::size_t before = tied.Get_size();
+        tied.Rebalance();
+        const std::size_t after = tied.Get_size();
+        std::printf("sharded tied     shards=%zu  size %zu before rebalance %zu after\n", shards, before, after);
+        if(after != before)
+            ok = false;
+    }
+
+    for(const char *dist: {"uniform", "clustered"}){
+        std::mt19937 gen(20);
+        std::vector<Circle> data;
+        for(std::size_t i = 0; i < n; ++i)
+            data.push_back(SuiteCircle(dist, gen));
+        const std::size_t sample = n / 10;
+
+        // the same slices of the rest for both, written at once by t threads
+        auto run = [&](std::size_t t, const std::function<void(const Circle&)> &insert){
+            std::vector<std::thread> threads;
+            const double t0 = Seconds();
+            for(std::size_t w = 0; w < t; ++w)
+                threads.emplace_back([&, w](){
+                    for(std::size_t i = sample + w; i < n; i += t)
+                        insert(data[i]);
+                });
+            for(auto &th: threads)
+                th.join();
+            return (n - sample) / (Seconds() - t0);
+        };
+        for(std::size_t t = 1; t <= max_threads; t *= 2){
+            // windows with room to spare, so that neither expires
+            QRTree single{2 * n};
+            QRShardedTree sharded(bound, shards, 2 * n);
+            for(std::size_t i = 0; i < sample; ++i){
+                single.InsertData(data[i]);
+                sharded.InsertData(data[i]);
+            }
+            sharded.Rebalance();
+
+            std::mutex lock;
+            const double locked = run(t, [&](const Circle &cir){
+                std::lock_guard<std::mutex> guard(lock);
+                single.InsertData(cir);
+            });
+            const double cut = run(t, [&](const Circle &cir){sharded.InsertData(cir);});
+            std::printf("sharded %-9s threads=%2zu shards=%zu  locked %10.0f inserts/s  sharded %10.0f inserts/s  skew=%.2f\n",
+                dist, t, shards, locked, cut, sharded.Get_skew());
+        }
+
+        QRShardedTree sharded(bound, shards, 2 * n);
+        for(auto &cir: data)
+            sharded.InsertData(cir);
+        const auto windows = RandomWindows(gen, 20000, 20);
+        auto rate = [&](){
+            std::size_t hits = 0;
+            const double t0 = Seconds();
+            for(auto &bb: windows)
+                sharded.Query(bb, [&hits](const Circle &){
+                    ++hits;
+                    return true;
+                });
+            return windows.size() / (Seconds() - t0);
+        };
+        const double skew = sharded.Get_skew();
+        const double before = rate();
+        const std::size_t size = sharded.Get_size();
+        const double t0 = Seconds();
+        sharded.Rebalance();
+        const double rebalance = Seconds() - t0;
+        const double after = rate();
+        std::printf("sharded %-9s even cuts skew=%.2f  rebalance %8.3f ms  queries/s %10.0f before %10.0f after  size=%zu\n",
+            dist, skew, rebalance * 1e3, before, after, sharded.Get_size());
+        if(sharded.Get_size() != size)
+            ok = false;
+    }
+    if(!ok)
+        std::printf("sharded FAILED: Rebalance lost circles\n");
+    return ok;
+}
+
+// Regression suite: steady-state FIFO churn at s, window queries of 0.01% to 10% of the
+// region, region deletes, for each data set, then min_child/max_child over uniform data
+static void BenchSuite(std::size_t n, std::size_t ops){
+    SuiteReport report;
+    std::printf("{\"suite\": \"qrtree\", \"n\": %zu, \"ops\": %zu, \"results\": [", n, ops);
+
+    auto churn = [&](const std::string &dist, int min_child, int max_child){
+        std::mt19937 gen(14);
+        QRTree tree{n, 2, min_child, max_child};
+        for(std::size_t i = 0; i < n; ++i)
+            tree.InsertData(SuiteCircle(dist, gen));
+
+        std::vector<Circle> data;
+        for(std::size_t i = 0; i < ops; ++i)
+            data.push_back(SuiteCircle(dist, gen));
+        std::vector<double> ns;
+        ns.reserve(ops);
+        const double t0 = Seconds();
+        for(auto &cir: data){
+            const double s0 = Seconds();
+            tree.InsertData(cir);
+            ns.push_back((Seconds() - s0) * 1e9);
+        }
+        report.add("churn", dist, min_child, max_child, "window", n, ns, Seconds() - t0, 0);
+    };
+
+    auto query = [&](const std::string &dist, int min_child, int max_child, double selectivity){
+        std::mt19937 gen(15);
+        QRTree tree{n, 2, min_child, max_child};
+        for(std::size_t i = 0; i < n; ++i)
+            tree.InsertData(SuiteCircle(dist, gen));
+
+        const auto windows = RandomWindows(gen, std::max<std::size_t>(ops / 10, 100),
+            std::sqrt(selectivity * REGION_X * REGION_Y));
+        std::vector<double> ns;
+        std::size_t hits = 0;
+        const double t0 = Seconds();
+        for(auto &bb: windows){
+            const double s0 = Seconds();
+            tree.Query(bb, [&hits](const Circle &){
+                ++hits;
+                return true;
+            });
+            ns.push_back((Seconds() - s0) * 1e9);
+        }
+        report.add("query", dist, min_child, max_child, "selectivity", selectivity, ns, Seconds() - t0, hits);
+    };
+
+    for(const std::string dist: {"uniform", "clustered", "skewed", "overlapped"}){
+        churn(dist, 10, 20);
+        for(double selectivity: {0.0001, 0.001, 0.01, 0.1})
+            query(dist, 10, 20, selectivity);
+
+        // regions of 0.1% of the area, each on a tree of its own as Delete leaves holes
+        std::mt19937 gen(16);
+        QRTree tree{n};
+        for(std::size_t i = 0; i < n; ++i)
+            tree.InsertData(SuiteCircle(dist, gen));
+        const auto regions = RandomWindows(gen, std::max<std::size_t>(ops / 1000, 10),
+            std::sqrt(0.001 * REGION_X * REGION_Y));
+        std::vector<double> ns;
+        const double t0 = Seconds();
+        for(auto &bb: regions){
+            const double s0 = Seconds();
+            tree.Delete(bb);
+            ns.push_back((Seconds() - s0) * 1e9);
+        }
+        std::size_t left = 0;
+        tree.Query(QRBoundingBox(-1e9, 1e9, -1e9, 1e9), [&left](const Circle &){
+            ++left;
+            return true;
+        });
+        report.add("delete", dist, 10, 20, "selectivity", 0.001, ns, Seconds() - t0, n - left);
+    }
+
+    const int fanout[][2] = {{2, 4}, {4, 8}, {6, 12}, {10, 20}, {16, 32}, {25, 50}};
+    for(auto &f: fanout){
+        churn("uniform", f[0], f[1]);
+        query("uniform", f[0], f[1], 0.001);
+    }
+    std::printf("\n]}\n");
+}
+
+static std::size_t Arg(int argc, char **argv, int i, std::size_t def){
+    return argc > i ? std::strtoul(argv[i], nullptr, 10) : def;
+}
+
+int main(int argc, char **argv){
+    const std::string workload = argc > 1 ? argv[1] : "churn";
+
+    if(workload == "churn"){
+        // ./bench churn [window] [ops]
+        const std::size_t window = Arg(argc, argv, 2, 5000);
+        const std::size_t ops = Arg(argc, argv, 3, 5000);
+        BenchChurn(window, ops, 0);
+        BenchChurn(window, ops, QRTREE_POOL_SLAB);
+    }
+    else if(workload == "bulkload"){
+        // ./bench bulkload [n]
+        BenchBulkLoad(Arg(argc, argv, 2, 100000));
+    }
+    else if(workload == "query"){
+        // ./bench query [n] [window side]
+        BenchQueryApi(Arg(argc, argv, 2, 100000), Arg(argc, argv, 3, 200));
+    }
+    else if(workload == "nearest"){
+        // ./bench nearest [n] [k]
+        BenchNearest(Arg(argc, argv, 2, 100000), Arg(argc, argv, 3, 10));
+    }
+    else if(workload == "refine"){
+        // ./bench refine [n] [window side]
+        BenchRefine(Arg(argc, argv, 2, 100000), Arg(argc, argv, 3, 10));
+    }
+    else if(workload == "layout"){
+        // ./bench layout [n] [window side]
+        BenchLayout(Arg(argc, argv, 2, 200000), Arg(argc, argv, 3, 50));
+    }
+    else if(workload == "scalar"){
+        // ./bench scalar [n] [window side]
+        BenchScalarTree<double>("double", Arg(argc, argv, 2, 200000), Arg(argc, argv, 3, 50));
+        BenchScalarTree<float>("float", Arg(argc, argv, 2, 200000), Arg(argc, argv, 3, 50));
+    }
+    else if(workload == "stress"){
+        // ./bench stress [readers] [seconds], exits with 1 on a broken snapshot
+        if(!BenchStress(Arg(argc, argv, 2, 4), Arg(argc, argv, 3, 5)))
+            return 1;
+    }
+    else if(workload == "concurrent"){
+        // ./bench concurrent [max readers] [seconds]
+        BenchConcurrent(Arg(argc, argv, 2, 8), Arg(argc, argv, 3, 2));
+    }
+    else if(workload == "expiry"){
+        // ./bench expiry [window] [ops]
+        BenchExpiry(Arg(argc, argv, 2, 20000), Arg(argc, argv, 3, 100000));
+    }
+    else if(workload == "moving"){
+        // ./bench moving [n] [ticks] [step]
+        BenchMoving(Arg(argc, argv, 2, 50000), Arg(argc, argv, 3, 10), argc > 4 ? std::atof(argv[4]) : 2.0);
+    }
+    else if(workload == "warmstart"){
+        // ./bench warmstart [n] [file]
+        BenchWarmStart(Arg(argc, argv, 2, 1000000), argc > 3 ? argv[3] : "/tmp/bench.qrtree");
+    }
+    else if(workload == "suite"){
+        // ./bench suite [n] [ops], JSON on stdout
+        BenchSuite(Arg(argc, argv, 2, 100000), Arg(argc, argv, 3, 10000));
+    }
+    else if(workload == "stats"){
+        // ./bench stats [window] [rounds]
+        BenchStats(Arg(argc, argv, 2, 20000), Arg(argc, argv, 3, 10));
+    }
+    else if(workload == "delete"){
+        // ./bench delete [n]
+        BenchDelete(Arg(argc, argv, 2, 100000));
+    }
+    else if(workload == "join"){
+        // ./bench join [n] [max threads]
+        BenchJoin(Arg(argc, argv, 2, 200000), Arg(argc, argv, 3, std::max(1u, std::thread::hardware_concurrency())));
+    }
+    else if(workload == "raster"){
+        // ./bench raster [n] [max threads]
+        BenchRaster(Arg(argc, argv, 2, 500000), Arg(argc, argv, 3, std::max(1u, std::thread::hardware_concurrency())));
+    }
+    else if(workload == "recent"){
+        // ./bench recent [n]
+        BenchRecent(Arg(argc, argv, 2, 500000));
+    }
+    else if(workload == "shapes"){
+        // ./bench shapes [n] [queries]
+        BenchShapes(Arg(argc, argv, 2, 500000), Arg(argc, argv, 3, 5000));
+    }
+    else if(workload == "subscribe"){
+        // ./bench subscribe [n] [viewports] [frames], exits with 1 if an event is wrong or missing
+        if(!BenchSubscribe(Arg(argc, argv, 2, 200000), Arg(argc, argv, 3, 64), Arg(argc, argv, 4, 500)))
+            return 1;
+    }
+    else if(workload == "cache"){
+        // ./bench cache [n] [viewports] [frames], exits with 1 if CachedQuery differs from Query
+        if(!BenchCache(Arg(argc, argv, 2, 200000), Arg(argc, argv, 3, 64), Arg(argc, argv, 4, 500)))
+            return 1;
+    }
+    else if(workload == "sharded"){
+        // ./bench sharded [n] [shards] [max threads], exits with 1 if Rebalance loses circles
+        if(!BenchSharded(Arg(argc, argv, 2, 500000), Arg(argc, argv, 3, 16),
+            Arg(argc, argv, 4, std::max(1u, std::thread::hardware_concurrency()))))
+            return 1;
+    }
+    else if(workload == "strategy"){
+        // ./bench strategy [n]
+        BenchStrategy(Arg(argc, argv, 2, 200000));
+    }
+    else if(workload == "compact"){
+        // ./bench compact [n] [generations]
+        BenchCompact(Arg(argc, argv, 2, 500000), Arg(argc, argv, 3, 4));
+    }
+    else if(workload == "aggregate"){
+        // ./bench aggregate [n]
+        BenchAggregate(Arg(argc, argv, 2, 1000000));
+    }
+    else if(workload == "batch"){
+        // ./bench batch [n] [queries per batch] [max threads]
+        BenchBatch(Arg(argc, argv, 2, 200000), Arg(argc, argv, 3, 5000),
+            Arg(argc, argv, 4, std::max(1u, std::thread::hardware_concurrency())));
+    }
+    else{
+        std::fprintf(stderr, "unknown workload %s\n", workload.c_str());
+        return 1;
+    }
+    return 0;
+}
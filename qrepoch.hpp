@@ -0,0 +1,80 @@
+/*
+ *  Copyright (c) 2018 Zuoshui Zhou <zuoshui.zhou@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of version 2.1 of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#ifndef QREPOCH_HPP
+#define QREPOCH_HPP
+#include <atomic>
+#include <cstdint>
+#include <limits>
+
+// readers that can hold a snapshot of one tree at the same time
+#define QRTREE_MAX_READERS 64
+
+// Epoch based reclamation for one writer and up to QRTREE_MAX_READERS readers.
+// A reader pins the current epoch in a slot of its own before it loads the root and
+// clears the slot when done. The writer tags what it unlinks with the current epoch,
+// advances the epoch after publishing, and may free a node once every pinned slot
+// is newer than its tag.
+class QREpoch{
+private:
+    struct alignas(64) Slot{
+        std::atomic<std::uint64_t> epoch;
+    };
+
+    Slot _slots[QRTREE_MAX_READERS];
+    alignas(64) std::atomic<std::uint64_t> _epoch;
+
+public:
+    static const std::uint64_t idle = std::numeric_limits<std::uint64_t>::max();
+
+    QREpoch(): _epoch(0){
+        for(auto &s: _slots)
+            s.epoch.store(idle, std::memory_order_relaxed);
+    }
+    QREpoch(const QREpoch&) = delete;
+    QREpoch& operator=(const QREpoch&) = delete;
+
+    // reader side, returns the slot to unpin. Spins while all slots are taken
+    int Pin(){
+        for(;;){
+            for(int i = 0; i < QRTREE_MAX_READERS; ++i){
+                std::uint64_t expected = idle;
+                if(_slots[i].epoch.load(std::memory_order_relaxed) == idle &&
+                   _slots[i].epoch.compare_exchange_strong(expected, _epoch.load()))
+                    return i;
+            }
+        }
+    }
+    void Unpin(int slot){_slots[slot].epoch.store(idle, std::memory_order_release);}
+
+    // writer side
+    std::uint64_t Current() const{return _epoch.load(std::memory_order_relaxed);}
+    void Advance(){_epoch.fetch_add(1);}
+    // oldest epoch still pinned, idle if none
+    std::uint64_t MinPinned() const{
+        std::uint64_t m = idle;
+        for(auto &s: _slots){
+            const std::uint64_t e = s.epoch.load();
+            if(e < m)
+                m = e;
+        }
+        return m;
+    }
+};
+
+#endif
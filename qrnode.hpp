@@ -24,69 +24,534 @@
 #include <functional>
 #include <algorithm>
 #include <limits>
+#include <cmath>
+#include <type_traits>
+#include <cstdint>
+#include <array>
 #include "circle.hpp"
 
-struct QRBoundingBox{
+// Axis aligned box of Dim dimensions. Every loop runs to the constant Dim, so the
+// compiler unrolls them.
+template<int Dim, typename Scalar>
+struct QRBasicBox{
     
-    std::pair<double, double> range[2];
+    std::pair<Scalar, Scalar> range[Dim];
 
-    QRBoundingBox(){}
-    QRBoundingBox(double x1, double x2, double y1, double y2);
+    QRBasicBox(){}
+    // min and max of each axis in turn, x1, x2, y1, y2, ...
+    template<typename... T, typename = typename std::enable_if<sizeof...(T) == 2 * Dim>::type>
+    QRBasicBox(T... bounds);
     void init();
-    bool expandToContain(const QRBoundingBox &bb);
+    bool expandToContain(const QRBasicBox &bb);
 
-    double perimeter() const;
-    double area() const;
-    bool contains(const QRBoundingBox &bb) const;
-    bool overlaps(const QRBoundingBox &bb) const;
+    Scalar perimeter() const;
+    Scalar area() const;
+    bool contains(const QRBasicBox &bb) const;
+    bool overlaps(const QRBasicBox &bb) const;
 
-    double overlapArea(const QRBoundingBox &bb) const;
-    double distance(const QRBoundingBox &bb) const;
+    Scalar overlapArea(const QRBasicBox &bb) const;
+    // squared distance between the centres, only good for ordering the children of one node
+    Scalar distance(const QRBasicBox &bb) const;
+    // distance from a point of Dim coordinates to the nearest point of the box, 0 inside.
+    // A lower bound of the distance to anything contained in the box
+    Scalar minDistance(const Scalar *point) const{return std::sqrt(minDistanceSquared(point));}
+    // its square, which orders boxes the same without a root
+    Scalar minDistanceSquared(const Scalar *point) const;
+    // how far along the ray from origin in direction dir, of unit length, it enters the
+    // box: 0 from inside, infinity if it misses. Slabs, one axis at a time
+    Scalar rayEntry(const Scalar *origin, const Scalar *dir) const;
 };
 
+template<int Dim, typename Scalar>
+template<typename... T, typename>
+QRBasicBox<Dim, Scalar>::QRBasicBox(T... bounds){
+    const Scalar b[] = {Scalar(bounds)...};
+    for(int i = 0; i < Dim; ++i){
+        range[i].first = b[2 * i];
+        range[i].second = b[2 * i + 1];
+    }
+}
+
+// 将起点设为最大，终点设为最小，
+template<int Dim, typename Scalar>
+void QRBasicBox<Dim, Scalar>::init(){
+    for (int axis = 0; axis < Dim; axis++){
+		range[axis].first = std::numeric_limits<Scalar>::max();
+		range[axis].second = std::numeric_limits<Scalar>::lowest();
+	}
+}
+
+template<int Dim, typename Scalar>
+bool QRBasicBox<Dim, Scalar>::expandToContain(const QRBasicBox &bb){
+    bool modified = false;
+    for(int i =0; i<Dim; ++i){
+        if(range[i].first > bb.range[i].first){
+            range[i].first = bb.range[i].first;
+            modified = true;
+        }
+        if(range[i].second < bb.range[i].second){
+            range[i].second = bb.range[i].second;
+            modified = true;
+        }
+    }
+    return modified;
+}
+
+// the margin, sum of the edges
+template<int Dim, typename Scalar>
+Scalar QRBasicBox<Dim, Scalar>::perimeter() const{
+    Scalar margin = 0;
+    for(int i =0; i<Dim; ++i)
+        margin += range[i].second - range[i].first;
+    return margin;
+}
+
+template<int Dim, typename Scalar>
+Scalar QRBasicBox<Dim, Scalar>::area() const{
+    Scalar area = 1;
+    for(int i =0; i<Dim; ++i)
+        area *= range[i].second - range[i].first;
+    return area;
+}
+
+template<int Dim, typename Scalar>
+bool QRBasicBox<Dim, Scalar>::contains(const QRBasicBox &bb) const{
+    for(int i =0; i<Dim; ++i){
+        if(range[i].first > bb.range[i].first)
+            return false;
+        if(range[i].second < bb.range[i].second)
+            return false;
+    }
+    return true;
+}
+
+// 如果一个点与搜寻目标的各个维度上的range，都有相交，即为overlap，其反为，存在一个维度，range不相交错。
+template<int Dim, typename Scalar>
+bool QRBasicBox<Dim, Scalar>::overlaps(const QRBasicBox &bb) const{
+    for(int i =0; i<Dim; ++i)
+        if (range[i].first > bb.range[i].second || bb.range[i].first > range[i].second)
+				return false;
+    return true;
+}
+
+template<int Dim, typename Scalar>
+Scalar QRBasicBox<Dim, Scalar>::overlapArea(const QRBasicBox &bb) const{
+    Scalar area = 1;
+    for(int i =0; i<Dim; ++i){
+        const Scalar lo = std::max(range[i].first, bb.range[i].first);
+        const Scalar hi = std::min(range[i].second, bb.range[i].second);
+        if(hi <= lo)
+            return 0;
+        area *= hi - lo;
+    }
+    return area;
+}
+
+template<int Dim, typename Scalar>
+Scalar QRBasicBox<Dim, Scalar>::distance(const QRBasicBox &bb) const{
+    Scalar dist = 0;
+    for(int i = 0; i < Dim; ++i){
+        Scalar x1 = (range[i].first + range[i].second)/2;
+        Scalar x2 = (bb.range[i].first + bb.range[i].second)/2;
+
+        dist +=  (x1 - x2) * (x1 - x2);
+    }
+    return dist;
+}
+
+template<int Dim, typename Scalar>
+Scalar QRBasicBox<Dim, Scalar>::minDistanceSquared(const Scalar *point) const{
+    // without branches, which side of the box the point lies is hard to predict
+    Scalar dist = 0;
+    for(int i = 0; i < Dim; ++i){
+        const Scalar d = std::max(std::max(range[i].first - point[i], point[i] - range[i].second), Scalar(0));
+        dist += d * d;
+    }
+    return dist;
+}
+
+template<int Dim, typename Scalar>
+Scalar QRBasicBox<Dim, Scalar>::rayEntry(const Scalar *origin, const Scalar *dir) const{
+    const Scalar inf = std::numeric_limits<Scalar>::infinity();
+    Scalar enter = 0, leave = inf;
+    for(int i = 0; i < Dim; ++i){
+        if(dir[i] == 0){
+            if(origin[i] < range[i].first || origin[i] > range[i].second)
+                return inf;
+            continue;
+        }
+        Scalar a = (range[i].first - origin[i]) / dir[i];
+        Scalar b = (range[i].second - origin[i]) / dir[i];
+        if(a > b)
+            std::swap(a, b);
+        enter = std::max(enter, a);
+        leave = std::min(leave, b);
+        if(enter > leave)
+            return inf;
+    }
+    return enter;
+}
+
+typedef QRBasicBox<2, double> QRBoundingBox;
 typedef QRBoundingBox QRNode;
 
-struct Innernode: public QRNode{
-    Innernode(){}
-    Innernode(double x1, double x2, double y1, double y2)
-        :QRNode(x1, x2, y1, y2){}
-    std::vector<QRNode*> child;
+// a disc, sphere or their like in Dim dimensions
+template<int Dim, typename Scalar>
+struct QRBasicBall{
+    Scalar centre[Dim];
+    Scalar r;
+};
+
+// exact tests on balls, branch free so that they cost about as much as overlaps()
+template<int Dim, typename Scalar>
+inline bool BallOverlapsBox(const QRBasicBall<Dim, Scalar> &b, const QRBasicBox<Dim, Scalar> &bb){
+    Scalar dist = 0;
+    for(int i = 0; i < Dim; ++i){
+        const Scalar d = b.centre[i] - std::min(std::max(b.centre[i], bb.range[i].first), bb.range[i].second);
+        dist += d * d;
+    }
+    return dist <= b.r * b.r;
+}
+
+template<int Dim, typename Scalar>
+inline bool BallOverlapsBall(const QRBasicBall<Dim, Scalar> &a, const QRBasicBall<Dim, Scalar> &b){
+    Scalar dist = 0;
+    for(int i = 0; i < Dim; ++i)
+        dist += (a.centre[i] - b.centre[i]) * (a.centre[i] - b.centre[i]);
+    return dist <= (a.r + b.r) * (a.r + b.r);
+}
+
+// how far along the ray it enters the ball, 0 from inside, infinity if it misses
+template<int Dim, typename Scalar>
+inline Scalar RayEntersBall(const QRBasicBall<Dim, Scalar> &b, const Scalar *origin, const Scalar *dir){
+    // |origin + t dir - centre|^2 = r^2 with |dir| = 1
+    Scalar along = 0, dist = 0;
+    for(int i = 0; i < Dim; ++i){
+        const Scalar d = origin[i] - b.centre[i];
+        along += d * dir[i];
+        dist += d * d;
+    }
+    const Scalar c = dist - b.r * b.r;
+    if(c <= 0)
+        return 0;
+    const Scalar disc = along * along - c;
+    if(along >= 0 || disc < 0)
+        return std::numeric_limits<Scalar>::infinity();
+    return -along - std::sqrt(disc);
+}
+
+// 2-D shapes for the queries beyond boxes and balls
+
+// whether the segment from (x0, y0) to (x1, y1) meets the box, by clipping it to the slabs
+template<typename Scalar>
+inline bool SegmentMeetsBox(Scalar x0, Scalar y0, Scalar x1, Scalar y1, const QRBasicBox<2, Scalar> &bb){
+    const Scalar origin[2] = {x0, y0}, dir[2] = {x1 - x0, y1 - y0};
+    Scalar enter = 0, leave = 1;
+    for(int i = 0; i < 2; ++i){
+        if(dir[i] == 0){
+            if(origin[i] < bb.range[i].first || origin[i] > bb.range[i].second)
+                return false;
+            continue;
+        }
+        Scalar a = (bb.range[i].first - origin[i]) / dir[i];
+        Scalar b = (bb.range[i].second - origin[i]) / dir[i];
+        if(a > b)
+            std::swap(a, b);
+        enter = std::max(enter, a);
+        leave = std::min(leave, b);
+        if(enter > leave)
+            return false;
+    }
+    return true;
+}
+
+// squared distance from (x, y) to the segment from (x0, y0) to (x1, y1)
+template<typename Scalar>
+inline Scalar PointSegmentDistance2(Scalar x, Scalar y, Scalar x0, Scalar y0, Scalar x1, Scalar y1){
+    const Scalar dx = x1 - x0, dy = y1 - y0;
+    const Scalar len = dx * dx + dy * dy;
+    Scalar t = len > 0 ? ((x - x0) * dx + (y - y0) * dy) / len : 0;
+    t = std::min(std::max(t, Scalar(0)), Scalar(1));
+    const Scalar ex = x0 + t * dx - x, ey = y0 + t * dy - y;
+    return ex * ex + ey * ey;
+}
+
+// A simple polygon, convex or not, its corners in order either way round. Exact tests:
+// a box meets it iff one of its corners is inside the box, a corner of the box is inside
+// it or an edge crosses the box
+template<typename Scalar>
+struct QRBasicPolygon{
+    std::vector<std::array<Scalar, 2>> points;
+    QRBasicBox<2, Scalar> bound;
+
+    QRBasicPolygon(){}
+    explicit QRBasicPolygon(std::vector<std::array<Scalar, 2>> corners): points(std::move(corners)){
+        bound.init();
+        for(auto &p: points)
+            bound.expandToContain(QRBasicBox<2, Scalar>(p[0], p[0], p[1], p[1]));
+    }
+
+    // even-odd rule
+    bool contains(Scalar x, Scalar y) const{
+        bool in = false;
+        for(std::size_t i = 0, j = points.size() - 1; i < points.size(); j = i++){
+            const auto &a = points[i], &b = points[j];
+            if((a[1] > y) != (b[1] > y) && x < (b[0] - a[0]) * (y - a[1]) / (b[1] - a[1]) + a[0])
+                in = !in;
+        }
+        return in;
+    }
+    bool overlaps(const QRBasicBox<2, Scalar> &bb) const{
+        if(points.empty() || !bound.overlaps(bb))
+            return false;
+        for(auto &p: points)
+            if(p[0] >= bb.range[0].first && p[0] <= bb.range[0].second && p[1] >= bb.range[1].first && p[1] <= bb.range[1].second)
+                return true;
+        if(contains(bb.range[0].first, bb.range[1].first))
+            return true;
+        for(std::size_t i = 0, j = points.size() - 1; i < points.size(); j = i++)
+            if(SegmentMeetsBox(points[j][0], points[j][1], points[i][0], points[i][1], bb))
+                return true;
+        return false;
+    }
+    // the disc of radius r around (x, y)
+    bool overlapsDisc(Scalar x, Scalar y, Scalar r) const{
+        if(points.empty())
+            return false;
+        if(contains(x, y))
+            return true;
+        for(std::size_t i = 0, j = points.size() - 1; i < points.size(); j = i++)
+            if(PointSegmentDistance2(x, y, points[j][0], points[j][1], points[i][0], points[i][1]) <= r * r)
+                return true;
+        return false;
+    }
+};
+
+// A segment of half width r, everything within r of the line from (x0, y0) to (x1, y1)
+template<typename Scalar>
+struct QRBasicSegment{
+    Scalar x0, y0, x1, y1;
+    Scalar r;
+
+    QRBasicBox<2, Scalar> bounds() const{
+        return QRBasicBox<2, Scalar>(std::min(x0, x1) - r, std::max(x0, x1) + r, std::min(y0, y1) - r, std::max(y0, y1) + r);
+    }
+    // the box is within r if the segment crosses it, else the nearest points are an end
+    // of the segment and the box or a corner of the box and the segment
+    bool overlaps(const QRBasicBox<2, Scalar> &bb) const{
+        if(!bounds().overlaps(bb))
+            return false;
+        if(SegmentMeetsBox(x0, y0, x1, y1, bb))
+            return true;
+        const Scalar a[2] = {x0, y0}, b[2] = {x1, y1};
+        const Scalar ra = bb.minDistance(a), rb = bb.minDistance(b);
+        if(ra <= r || rb <= r)
+            return true;
+        for(int i = 0; i < 4; ++i){
+            const Scalar x = i & 1 ? bb.range[0].second : bb.range[0].first;
+            const Scalar y = i & 2 ? bb.range[1].second : bb.range[1].first;
+            if(PointSegmentDistance2(x, y, x0, y0, x1, y1) <= r * r)
+                return true;
+        }
+        return false;
+    }
+    bool overlapsDisc(Scalar x, Scalar y, Scalar radius) const{
+        return PointSegmentDistance2(x, y, x0, y0, x1, y1) <= (r + radius) * (r + radius);
+    }
+};
+
+// What the payloads below a node add up to, see QRBasicTree::Aggregate. r is the radius
+// of a Circle or ball and area its area, or volume beyond 2-D. Other payloads count with
+// r 0 and the volume of their box.
+template<typename Scalar>
+struct QRBasicSummary{
+    std::size_t count = 0;
+    Scalar sum_r = 0;
+    Scalar sum_area = 0;
+    Scalar min_r = std::numeric_limits<Scalar>::max();
+    Scalar max_r = std::numeric_limits<Scalar>::lowest();
+
+    void add(const QRBasicSummary &s){
+        count += s.count;
+        sum_r += s.sum_r;
+        sum_area += s.sum_area;
+        min_r = std::min(min_r, s.min_r);
+        max_r = std::max(max_r, s.max_r);
+    }
+    bool operator==(const QRBasicSummary &s) const{
+        return count == s.count && sum_r == s.sum_r && sum_area == s.sum_area && min_r == s.min_r && max_r == s.max_r;
+    }
+    bool operator!=(const QRBasicSummary &s) const{return !(*this == s);}
+};
+
+// inner nodes keep the summary of their subtree, so that Aggregate takes a subtree inside
+// the window whole. 0 saves the space and the upkeep, Aggregate then visits every hit
+#define QRTREE_AGGREGATE 1
+
+// inner nodes keep the oldest and newest stamp below them, so that a query for a span of
+// stamps skips the subtrees outside it. 0 saves the space and the upkeep, such a query
+// then tests every leaf in the window
+#define QRTREE_STAMPS 1
+
+template<int Dim, typename Scalar>
+struct QRBasicInnernode: public QRBasicBox<Dim, Scalar>{
+    QRBasicInnernode(){}
+    std::vector<QRBasicBox<Dim, Scalar>*> child;
     bool leafchild;
-    Innernode* parent;
+    QRBasicInnernode* parent;
+    // writer version the node was made or last written in, a node of an older version may be
+    // seen by readers. Written with its path up to the root
+    std::uint64_t version;
+#if QRTREE_AGGREGATE
+    QRBasicSummary<Scalar> summary;
+#endif
+#if QRTREE_STAMPS
+    std::uint64_t stamp_min;
+    std::uint64_t stamp_max;
+#endif
     int getLevel();
 };
 
+template<int Dim, typename Scalar>
+int QRBasicInnernode<Dim, Scalar>::getLevel(){
+    int level = 1;
+    auto i = this;
+    while(!i->leafchild){// 只要本点的孩子不是叶子，则继续
+        // 写在一起编译出问题，不知道为啥，就分开了
+        auto j = i->child[0];
+        i = static_cast<QRBasicInnernode*>(j);
+        ++level;
+    }
+    return level;
+}
+
+// What the tree needs to know of a payload: its bounding box, the exact tests that refine
+// a box hit, and the distance from a point for the nearest neighbour queries.
+// This default serves any payload with a bounds() member and refines no further than
+// that box. Specialise it for payloads of another shape, as done for Circle below.
+template<int Dim, typename Scalar, typename Payload>
+struct QRPayloadTraits{
+    typedef QRBasicBox<Dim, Scalar> Box;
+    typedef QRBasicBall<Dim, Scalar> Ball;
+
+    static Box bounds(const Payload &p){return p.bounds();}
+    // only asked once the bounding box overlaps bb
+    static bool overlaps(const Payload &, const Box &){return true;}
+    static bool overlaps(const Payload &p, const Ball &b){return BallOverlapsBox(b, bounds(p));}
+    // two payloads, only asked once their bounding boxes overlap
+    static bool overlaps(const Payload &, const Payload &){return true;}
+    // the 2-D shapes, against the box
+    static bool overlaps(const Payload &p, const QRBasicPolygon<Scalar> &poly){return poly.overlaps(bounds(p));}
+    static bool overlaps(const Payload &p, const QRBasicSegment<Scalar> &seg){return seg.overlaps(bounds(p));}
+    static Scalar distance(const Payload &p, const Scalar *point){return bounds(p).minDistance(point);}
+    // how far along a ray of unit direction it first meets the payload, infinity if never
+    static Scalar rayEntry(const Payload &p, const Scalar *origin, const Scalar *dir){return bounds(p).rayEntry(origin, dir);}
+    static QRBasicSummary<Scalar> summary(const Payload &p){return QRBasicSummary<Scalar>{1, 0, bounds(p).area(), 0, 0};}
+};
 
-// here Circle member is just a placeholder, you may replace it with any useful info.
-// hence the constructor should be rewroten
-struct Leafnode: public QRNode{
-    Circle cir;
-    Innernode* parent;
-    Leafnode(Circle tar):cir(tar){
-        range[0].first = tar.x - tar.r;
-        range[0].second = tar.x + tar.r;
-        range[1].first = tar.y - tar.r;
-        range[1].second = tar.y + tar.r;
+template<int Dim, typename Scalar>
+struct QRPayloadTraits<Dim, Scalar, QRBasicBall<Dim, Scalar>>{
+    typedef QRBasicBox<Dim, Scalar> Box;
+    typedef QRBasicBall<Dim, Scalar> Ball;
+
+    static Box bounds(const Ball &p){
+        Box bb;
+        for(int i = 0; i < Dim; ++i)
+            bb.range[i] = std::make_pair(p.centre[i] - p.r, p.centre[i] + p.r);
+        return bb;
+    }
+    static bool overlaps(const Ball &p, const Box &bb){return BallOverlapsBox(p, bb);}
+    static bool overlaps(const Ball &p, const Ball &b){return BallOverlapsBall(p, b);}
+    // the 2-D shapes, for a 2-D tree of balls
+    static bool overlaps(const Ball &p, const QRBasicPolygon<Scalar> &poly){return poly.overlapsDisc(p.centre[0], p.centre[1], p.r);}
+    static bool overlaps(const Ball &p, const QRBasicSegment<Scalar> &seg){return seg.overlapsDisc(p.centre[0], p.centre[1], p.r);}
+    static Scalar rayEntry(const Ball &p, const Scalar *origin, const Scalar *dir){return RayEntersBall(p, origin, dir);}
+    // to the surface, 0 inside
+    static Scalar distance(const Ball &p, const Scalar *point){
+        Scalar dist = 0;
+        for(int i = 0; i < Dim; ++i)
+            dist += (p.centre[i] - point[i]) * (p.centre[i] - point[i]);
+        return std::max(Scalar(0), std::sqrt(dist) - p.r);
+    }
+    static QRBasicSummary<Scalar> summary(const Ball &p){
+        // pi^(Dim/2) / Gamma(Dim/2 + 1) r^Dim
+        const Scalar unit = std::pow(Scalar(M_PI), Scalar(Dim) / 2) / std::tgamma(Scalar(Dim) / 2 + 1);
+        return QRBasicSummary<Scalar>{1, p.r, unit * std::pow(p.r, Scalar(Dim)), p.r, p.r};
     }
-    Leafnode* prev;
-    Leafnode* next;
 };
 
+// exact tests on the disc of a Circle
+inline bool DiscOverlapsBox(const Circle &c, const QRBoundingBox &bb){
+    const double dx = c.x - std::min(std::max(c.x, bb.range[0].first), bb.range[0].second);
+    const double dy = c.y - std::min(std::max(c.y, bb.range[1].first), bb.range[1].second);
+    return dx * dx + dy * dy <= c.r * c.r;
+}
+
+inline bool DiscOverlapsDisc(const Circle &a, const Circle &b){
+    const double dx = a.x - b.x;
+    const double dy = a.y - b.y;
+    return dx * dx + dy * dy <= (a.r + b.r) * (a.r + b.r);
+}
+
+template<>
+struct QRPayloadTraits<2, double, Circle>{
+    typedef QRBoundingBox Box;
+    typedef QRBasicBall<2, double> Ball;
+
+    static Box bounds(const Circle &c){return Box{c.x - c.r, c.x + c.r, c.y - c.r, c.y + c.r};}
+    static bool overlaps(const Circle &c, const Box &bb){return DiscOverlapsBox(c, bb);}
+    static bool overlaps(const Circle &c, const Ball &b){return DiscOverlapsDisc(c, Circle{b.r, b.centre[0], b.centre[1]});}
+    static bool overlaps(const Circle &a, const Circle &b){return DiscOverlapsDisc(a, b);}
+    static bool overlaps(const Circle &c, const QRBasicPolygon<double> &poly){return poly.overlapsDisc(c.x, c.y, c.r);}
+    static bool overlaps(const Circle &c, const QRBasicSegment<double> &seg){return seg.overlapsDisc(c.x, c.y, c.r);}
+    static double rayEntry(const Circle &c, const double *origin, const double *dir){
+        return RayEntersBall(Ball{{c.x, c.y}, c.r}, origin, dir);
+    }
+    // to the edge of the circle, 0 inside
+    static double distance(const Circle &c, const double *point){
+        const double dx = c.x - point[0], dy = c.y - point[1];
+        return std::max(0.0, std::sqrt(dx * dx + dy * dy) - c.r);
+    }
+    static QRBasicSummary<double> summary(const Circle &c){return QRBasicSummary<double>{1, c.r, M_PI * c.r * c.r, c.r, c.r};}
+};
+
+// here the payload is what the tree indexes, Circle by default; it needs a default
+// constructor and may be move-only. The member keeps its old name.
+template<int Dim, typename Scalar, typename Payload>
+struct QRBasicLeafnode: public QRBasicBox<Dim, Scalar>{
+    typedef QRPayloadTraits<Dim, Scalar, Payload> Traits;
+
+    Payload cir;
+    QRBasicInnernode<Dim, Scalar>* parent;
+    QRBasicLeafnode(){}
+    explicit QRBasicLeafnode(Payload tar): QRBasicBox<Dim, Scalar>(Traits::bounds(tar)), cir(std::move(tar)){}
+    // distance from a point to the payload, 0 inside
+    Scalar distanceTo(const Scalar *point) const{return Traits::distance(cir, point);}
+    QRBasicLeafnode* prev;
+    QRBasicLeafnode* next;
+    // insertion time or sequence number, see QRBasicTree::InsertData
+    std::uint64_t stamp;
+    // identity for handles, 0 once the leaf is freed
+    std::uint64_t id;
+};
 
+typedef QRBasicInnernode<2, double> Innernode;
+typedef QRBasicLeafnode<2, double, Circle> Leafnode;
 
 // 构造函数接受的参数是叶子，作为基准，成员函数的参数是分支，分支包含叶子之后增加的面积作为排序的原则，以升序排列
 // 这里用的指针，可以用const引用来实现
-struct AscendingSortByAreaEnlargement: public std::binary_function<const QRNode * const, const QRNode * const, bool>{
-    const QRNode item;
+template<typename Box>
+struct AscendingSortByAreaEnlargement{
+    const Box item;
 
-    explicit AscendingSortByAreaEnlargement(const QRNode *addThisItem):item(*addThisItem){}
+    explicit AscendingSortByAreaEnlargement(const Box *addThisItem):item(*addThisItem){}
 
-    bool operator() (const QRNode * const bi1, const QRNode * const bi2) const{
-        QRNode tmp1 = *bi1;
-        QRNode tmp2 = *bi2;
+    bool operator() (const Box * const bi1, const Box * const bi2) const{
+        Box tmp1 = *bi1;
+        Box tmp2 = *bi2;
 
-        double area1 = tmp1.area();
-        double area2 = tmp2.area();
+        auto area1 = tmp1.area();
+        auto area2 = tmp2.area();
 
         tmp1.expandToContain(item);
         tmp2.expandToContain(item);
@@ -95,42 +560,46 @@ struct AscendingSortByAreaEnlargement: public std::binary_function<const QRNode
     }
 };
 
-struct AscendingSortByFirstRange: public std::binary_function<const QRNode * const, const QRNode * const, bool>{
+template<typename Box>
+struct AscendingSortByFirstRange{
     const std::size_t axis;
 
     explicit AscendingSortByFirstRange(const std::size_t axis):axis(axis){}
 
-    bool operator() (const QRNode * const bi1, const QRNode * const bi2) const{
+    bool operator() (const Box * const bi1, const Box * const bi2) const{
         return bi1->range[axis].first < bi2->range[axis].first;
     }
 };
 
-struct AscendingSortBySecondRange: public std::binary_function<const QRNode * const, const QRNode * const, bool>{
+template<typename Box>
+struct AscendingSortBySecondRange{
     const std::size_t axis;
 
     explicit AscendingSortBySecondRange(const std::size_t axis):axis(axis){}
 
-    bool operator() (const QRNode * const bi1, const QRNode * const bi2) const{
+    bool operator() (const Box * const bi1, const Box * const bi2) const{
         return bi1->range[axis].second < bi2->range[axis].second;
     }
 };
 
 
-struct ExpandNode: std::unary_function<const QRNode* const, void>{
-    QRNode *node;
-    ExpandNode(QRNode* bb): node(bb){}
+template<typename Box>
+struct ExpandNode{
+    Box *node;
+    ExpandNode(Box* bb): node(bb){}
 
-    void operator() (const QRNode* const item){
+    void operator() (const Box* const item){
         node->expandToContain(*item);
     }
 };
 
-struct AscendingSortByDistance: public std::binary_function<const QRNode * const, const QRNode * const, bool>{
-    const QRNode* center;
+template<typename Box>
+struct AscendingSortByDistance{
+    const Box* center;
 
-    explicit AscendingSortByDistance(const QRNode * const _center): center(_center){}
+    explicit AscendingSortByDistance(const Box * const _center): center(_center){}
 
-    bool operator() (const QRNode* const bi1, const QRNode* const bi2) const {
+    bool operator() (const Box* const bi1, const Box* const bi2) const {
         return bi1->distance(*center) < bi2->distance(*center);
     }
 };
@@ -0,0 +1,328 @@
+/*
+ *  Copyright (c) 2018 Zuoshui Zhou <zuoshui.zhou@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of version 2.1 of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "qrpacked.hpp"
+
+static const char QRPackedMagic[8] = {'Q', 'R', 'T', 'R', 'E', 'E', 0, 0};
+
+static std::uint64_t RoundUp(std::uint64_t n, std::uint64_t to){
+    return (n + to - 1) / to * to;
+}
+
+QRPackedTree::QRPackedTree(const QRTree &tree): QRPackedTree(){
+    const Innernode *root = tree.Get_root();
+
+    // nodes numbered breadth first, a node's number is known when its parent is copied
+    std::vector<const Innernode*> order;
+    if(root)
+        order.push_back(root);
+    for(std::size_t i = 0; i < order.size(); ++i)
+        if(!order[i]->leafchild)
+            for(auto j: order[i]->child)
+                order.push_back(static_cast<const Innernode*>(j));
+
+    QRPackedHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, QRPackedMagic, sizeof(header.magic));
+    header.version = QRTREE_FILE_VERSION;
+    const std::size_t capacity = RoundUp(tree.max_child + 1, 4);
+    header.node_bytes = QRPackedNode::bytes(capacity);
+    header.node_n = order.size();
+    header.leaf_n = tree.Get_size();
+    header.size_full = tree._size_full;
+    header.min_child = tree.min_child;
+    header.max_child = tree.max_child;
+    // one block, nodes aligned for the kernels
+    header.nodes = RoundUp(sizeof(QRPackedHeader), 64);
+    header.leaves = header.nodes + header.node_n * header.node_bytes;
+    header.stamps = RoundUp(header.leaves + header.leaf_n * sizeof(Circle), 8);
+    header.order = header.stamps + header.leaf_n * sizeof(std::uint64_t);
+    header.bytes = header.order + header.leaf_n * sizeof(std::uint32_t);
+
+    _storage.reset(new unsigned char[header.bytes + 64]);
+    auto base = reinterpret_cast<std::uintptr_t>(_storage.get());
+    auto image = reinterpret_cast<unsigned char*>(RoundUp(base, 64));
+    std::memcpy(image, &header, sizeof(header));
+
+    unsigned char *nodes = image + header.nodes;
+    auto leaves = reinterpret_cast<Circle*>(image + header.leaves);
+    auto stamps = reinterpret_cast<std::uint64_t*>(image + header.stamps);
+    auto fifo = reinterpret_cast<std::uint32_t*>(image + header.order);
+
+    // where each leaf went, for the FIFO order
+    std::unordered_map<const Leafnode*, std::uint32_t> index;
+    index.reserve(header.leaf_n);
+
+    std::uint32_t next_node = 1, next_leaf = 0;
+    for(std::size_t i = 0; i < order.size(); ++i){
+        const Innernode *src = order[i];
+        std::memset(nodes + i * header.node_bytes, 0, header.node_bytes);
+        QRPackedNode &dst = *reinterpret_cast<QRPackedNode*>(nodes + i * header.node_bytes);
+        assert(src->child.size() <= capacity);
+        dst.count = src->child.size();
+        dst.leafchild = src->leafchild;
+        dst.capacity = capacity;
+        double *box = dst.minx();
+        std::uint32_t *child = dst.child();
+        for(std::size_t j = 0; j < src->child.size(); ++j){
+            const QRNode *c = src->child[j];
+            box[j] = c->range[0].first;
+            box[capacity + j] = c->range[0].second;
+            box[2 * capacity + j] = c->range[1].first;
+            box[3 * capacity + j] = c->range[1].second;
+
+            if(src->leafchild){
+                leaves[next_leaf] = static_cast<const Leafnode*>(c)->cir;
+                index[static_cast<const Leafnode*>(c)] = next_leaf;
+                child[j] = next_leaf++;
+            }
+            else
+                child[j] = next_node++;
+        }
+    }
+    assert(next_leaf == header.leaf_n);
+
+    std::size_t place = 0;
+    for(const Leafnode *leaf = tree.front; leaf && place < header.leaf_n; leaf = leaf->next, ++place){
+        stamps[place] = leaf->stamp;
+        fifo[place] = index.at(leaf);
+    }
+    assert(place == header.leaf_n);
+
+    Attach(image);
+}
+
+std::unique_ptr<QRPackedTree> QRPackedTree::Pack(const QRTree &tree){
+    // a node overflows to max_child + 1 before it is split
+    if(tree.max_child + 1 > QRTREE_PACKED_CAPACITY)
+        return nullptr;
+    return std::unique_ptr<QRPackedTree>(new QRPackedTree(tree));
+}
+
+QRPackedTree::~QRPackedTree(){
+    if(_mapped)
+        munmap(const_cast<QRPackedHeader*>(_header), _mapped);
+}
+
+void QRPackedTree::Attach(const unsigned char *image){
+    _header = reinterpret_cast<const QRPackedHeader*>(image);
+    _node_n = _header->node_n;
+    _leaf_n = _header->leaf_n;
+    _nodes = image + _header->nodes;
+    _node_bytes = _header->node_bytes;
+    _leaves = reinterpret_cast<const Circle*>(image + _header->leaves);
+}
+
+void QRPackedTree::Query(const QRBoundingBox &bb, std::vector<Circle> &out, QRRefine refine) const{
+    Query(bb, [&out](const Circle &cir){
+        out.push_back(cir);
+        return true;
+    }, refine);
+}
+
+bool QRPackedTree::Save(const char *path) const{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(_header), _header->bytes);
+    return bool(file);
+}
+
+bool QRPackedTree::Check(const unsigned char *image, std::size_t size){
+    // written by this layout and whole
+    if(size < sizeof(QRPackedHeader))
+        return false;
+    const QRPackedHeader &header = *reinterpret_cast<const QRPackedHeader*>(image);
+    if(std::memcmp(header.magic, QRPackedMagic, sizeof(QRPackedMagic)) != 0 || header.version != QRTREE_FILE_VERSION
+        || header.bytes != size)
+        return false;
+    // as a tree can be built with them, and split
+    if(header.max_child < 1 || header.max_child >= QRTREE_PACKED_CAPACITY || header.min_child < 1
+        || header.min_child > (header.max_child + 1) / 2)
+        return false;
+    const std::size_t capacity = RoundUp(header.max_child + 1, 4);
+    if(header.node_bytes != QRPackedNode::bytes(capacity))
+        return false;
+
+    // the sections in order, aligned and inside the image. The counts are bounded before
+    // they are multiplied, so nothing overflows
+    std::uint64_t at = sizeof(QRPackedHeader);
+    auto section = [&at, size](std::uint64_t offset, std::uint64_t n, std::uint64_t unit, std::uint64_t align){
+        if(offset < at || offset > size || offset % align != 0 || n > (size - offset) / unit)
+            return false;
+        at = offset + n * unit;
+        return true;
+    };
+    if(!section(header.nodes, header.node_n, header.node_bytes, 32)
+        || !section(header.leaves, header.leaf_n, sizeof(Circle), alignof(Circle))
+        || !section(header.stamps, header.leaf_n, sizeof(std::uint64_t), alignof(std::uint64_t))
+        || !section(header.order, header.leaf_n, sizeof(std::uint32_t), alignof(std::uint32_t))
+        || (header.node_n == 0 && header.leaf_n != 0))
+        return false;
+
+    // every node but the root the child of one node before it, every circle of one
+    // leaf-parent, and the leaf-parents all at one depth. depth is 0 for a node not
+    // reached yet
+    std::vector<std::uint32_t> depth(header.node_n, 0);
+    std::vector<bool> held(header.leaf_n, false);
+    std::uint64_t circles = 0;
+    std::uint32_t leaf_depth = 0;
+    if(header.node_n)
+        depth[0] = 1;
+    for(std::uint64_t i = 0; i < header.node_n; ++i){
+        const QRPackedNode &node = *reinterpret_cast<const QRPackedNode*>(image + header.nodes + i * header.node_bytes);
+        const std::uint32_t *child = node.child();
+        if(depth[i] == 0 || node.capacity != capacity || node.leafchild > 1 || node.count > (std::uint32_t)header.max_child)
+            return false;
+        // only a root over nothing is empty
+        if(node.count == 0 && (i > 0 || !node.leafchild))
+            return false;
+        if(node.leafchild){
+            if(leaf_depth == 0)
+                leaf_depth = depth[i];
+            if(depth[i] != leaf_depth)
+                return false;
+            for(std::uint32_t j = 0; j < node.count; ++j){
+                if(child[j] >= header.leaf_n || held[child[j]])
+                    return false;
+                held[child[j]] = true;
+            }
+            circles += node.count;
+        }
+        else
+            for(std::uint32_t j = 0; j < node.count; ++j){
+                if(child[j] <= i || child[j] >= header.node_n || depth[child[j]] != 0)
+                    return false;
+                depth[child[j]] = depth[i] + 1;
+            }
+    }
+    if(circles != header.leaf_n)
+        return false;
+
+    // the FIFO order names every circle once, with the stamps in order
+    auto stamps = reinterpret_cast<const std::uint64_t*>(image + header.stamps);
+    auto fifo = reinterpret_cast<const std::uint32_t*>(image + header.order);
+    std::fill(held.begin(), held.end(), false);
+    for(std::uint64_t i = 0; i < header.leaf_n; ++i){
+        if(fifo[i] >= header.leaf_n || held[fifo[i]] || (i > 0 && stamps[i] < stamps[i - 1]))
+            return false;
+        held[fifo[i]] = true;
+    }
+    return true;
+}
+
+std::unique_ptr<QRPackedTree> QRPackedTree::Open(const char *path){
+    const int fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return nullptr;
+    struct stat st;
+    void *map = MAP_FAILED;
+    if(fstat(fd, &st) == 0 && (std::size_t)st.st_size >= sizeof(QRPackedHeader))
+        map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping holds its own reference to the file
+    close(fd);
+    if(map == MAP_FAILED)
+        return nullptr;
+
+    if(!Check(static_cast<const unsigned char*>(map), st.st_size)){
+        munmap(map, st.st_size);
+        return nullptr;
+    }
+
+    std::unique_ptr<QRPackedTree> packed(new QRPackedTree());
+    packed->_mapped = st.st_size;
+    packed->Attach(static_cast<const unsigned char*>(map));
+    return packed;
+}
+
+// the node boxes are those the parents hold, the root is bounded by its children
+std::unique_ptr<QRTree> QRPackedTree::Thaw() const{
+    std::unique_ptr<QRTree> tree(new QRTree(_header->size_full, 2, _header->min_child, _header->max_child));
+    if(_node_n == 0)
+        return tree;
+
+    std::vector<Innernode*> inner(_node_n);
+    std::vector<Leafnode*> leaves(_leaf_n);
+    inner[0] = tree->NewInner(Get_node(0).leafchild);
+    inner[0]->parent = nullptr;
+    inner[0]->init();
+    for(std::size_t i = 0; i < _node_n; ++i){
+        const QRPackedNode &src = Get_node(i);
+        const std::uint32_t *child = src.child();
+        Innernode *dst = inner[i];
+        dst->child.resize(src.count);
+        for(std::size_t j = 0; j < src.count; ++j){
+            QRNode *c;
+            if(src.leafchild){
+                Leafnode *leaf = tree->NewLeaf(Circle(_leaves[child[j]]));
+                leaf->parent = dst;
+                leaves[child[j]] = leaf;
+                c = leaf;
+            }
+            else{
+                Innernode *node = tree->NewInner(Get_node(child[j]).leafchild);
+                node->parent = dst;
+                inner[child[j]] = node;
+                c = node;
+            }
+            c->range[0] = std::make_pair(src.minx()[j], src.maxx()[j]);
+            c->range[1] = std::make_pair(src.miny()[j], src.maxy()[j]);
+            dst->child[j] = c;
+        }
+        if(i == 0)
+            std::for_each(dst->child.begin(), dst->child.end(), ExpandNode<QRNode>(dst));
+    }
+
+    // children come after their parent, so the summaries are added up from the back
+    for(std::size_t i = _node_n; i-- > 0; )
+        QRTree::Summarise(inner[i]);
+
+    auto stamps = reinterpret_cast<const std::uint64_t*>(reinterpret_cast<const unsigned char*>(_header) + _header->stamps);
+    auto fifo = reinterpret_cast<const std::uint32_t*>(reinterpret_cast<const unsigned char*>(_header) + _header->order);
+    Leafnode *last = nullptr;
+    for(std::size_t i = 0; i < _leaf_n; ++i){
+        Leafnode *leaf = leaves[fifo[i]];
+        leaf->stamp = stamps[i];
+        leaf->prev = last;
+        leaf->next = nullptr;
+        if(last)
+            last->next = leaf;
+        else
+            tree->front = leaf;
+        last = leaf;
+    }
+    tree->end = last;
+    tree->_root = inner[0];
+    tree->_size = _leaf_n;
+    tree->_stamp = last ? last->stamp : 0;
+    return tree;
+}
+
+QRTree &QRMappedTree::Tree(){
+    if(!_tree){
+        assert(_packed);
+        _tree = _packed->Thaw();
+        _packed.reset();
+    }
+    return *_tree;
+}
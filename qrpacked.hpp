@@ -0,0 +1,192 @@
+/*
+ *  Copyright (c) 2018 Zuoshui Zhou <zuoshui.zhou@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of version 2.1 of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#ifndef QRPACKED_HPP
+#define QRPACKED_HPP
+#include <cstdint>
+#include <memory>
+#include "qrtree.hpp"
+
+// most children a packed node can hold, one bit each in the masks of the kernels
+#define QRTREE_PACKED_CAPACITY 64
+// layout of the files written by QRPackedTree::Save, raised whenever it changes
+#define QRTREE_FILE_VERSION 2
+
+// One node of the packed layout, followed by the boxes of its children in four aligned
+// arrays of capacity doubles and then their indices, so that a whole node is tested by
+// QROverlapMask without touching the children. capacity is max_child + 1 of the source
+// tree rounded up to a whole AVX register, the nodes lie bytes(capacity) apart.
+struct alignas(32) QRPackedNode{
+    std::uint32_t count;
+    std::uint32_t leafchild;
+    std::uint32_t capacity;
+
+    static std::size_t bytes(std::size_t capacity){
+        return (sizeof(QRPackedNode) + capacity * (4 * sizeof(double) + sizeof(std::uint32_t)) + 31) / 32 * 32;
+    }
+    const double *minx() const{return reinterpret_cast<const double*>(this + 1);}
+    const double *maxx() const{return minx() + capacity;}
+    const double *miny() const{return minx() + 2 * capacity;}
+    const double *maxy() const{return minx() + 3 * capacity;}
+    // index of the child node, or of the circle below a leaf-parent
+    const std::uint32_t *child() const{return reinterpret_cast<const std::uint32_t*>(minx() + 4 * capacity);}
+    double *minx(){return const_cast<double*>(static_cast<const QRPackedNode*>(this)->minx());}
+    std::uint32_t *child(){return const_cast<std::uint32_t*>(static_cast<const QRPackedNode*>(this)->child());}
+
+    QRBoxArrays arrays() const{return QRBoxArrays{{minx(), miny()}, {maxx(), maxy()}, count};}
+};
+
+// Start of a packed image, in memory as in a file. The sections follow at the byte
+// offsets given here: nodes, circles, their stamps in FIFO order and the index of the
+// circle at each FIFO place, oldest first.
+struct QRPackedHeader{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t node_bytes;       // QRPackedNode::bytes of the node capacity
+    std::uint64_t node_n;
+    std::uint64_t leaf_n;
+    std::uint64_t size_full;
+    std::int32_t min_child;
+    std::int32_t max_child;
+    std::uint64_t nodes;
+    std::uint64_t leaves;
+    std::uint64_t stamps;
+    std::uint64_t order;
+    std::uint64_t bytes;            // the whole image
+};
+
+// Read-only copy of a QRTree in the packed layout, for the default 2-D double tree only: the same nodes, in breadth-first
+// order in one block, with the circles in another. Build it again after the source
+// tree changed. The block is pointer-free, so Save writes it as it is and Open maps it
+// back without parsing.
+class QRPackedTree{
+private:
+    std::unique_ptr<unsigned char[]> _storage;
+    // the image, in _storage or mapped from a file
+    const QRPackedHeader *_header;
+    std::size_t _mapped;
+    const unsigned char *_nodes;
+    std::size_t _node_bytes;
+    const Circle *_leaves;
+    std::size_t _node_n;
+    std::size_t _leaf_n;
+
+    QRPackedTree(): _header(nullptr), _mapped(0), _nodes(nullptr), _node_bytes(0), _leaves(nullptr), _node_n(0), _leaf_n(0){}
+    explicit QRPackedTree(const QRTree &tree);
+    void Attach(const unsigned char *image);
+    // whether size bytes at image are an image of this layout that Query and Thaw can walk
+    // without leaving it
+    static bool Check(const unsigned char *image, std::size_t size);
+
+    template<typename F>
+    bool InnerVisit(std::uint32_t index, const QRBoundingBox &bb, bool exact, F &visit) const;
+
+public:
+    // nullptr if a node of the tree may hold more than QRTREE_PACKED_CAPACITY children
+    static std::unique_ptr<QRPackedTree> Pack(const QRTree &tree);
+    QRPackedTree(const QRPackedTree&) = delete;
+    QRPackedTree& operator=(const QRPackedTree&) = delete;
+    ~QRPackedTree();
+
+    // same forms as QRTree::Query
+    template<typename F>
+    void Query(const QRBoundingBox &bb, F &&visit, QRRefine refine = QRRefine::Box) const;
+    void Query(const QRBoundingBox &bb, std::vector<Circle> &out, QRRefine refine = QRRefine::Box) const;
+
+    // false if the file could not be written
+    bool Save(const char *path) const;
+    // maps a file written by Save, nullptr if it cannot be read, has another layout or is
+    // cut short or inconsistent. Every node and stamp is looked at once for that
+    static std::unique_ptr<QRPackedTree> Open(const char *path);
+    // a mutable tree of the same nodes, FIFO order and stamps
+    std::unique_ptr<QRTree> Thaw() const;
+
+    std::size_t Get_size() const{return _leaf_n;}
+    std::size_t Get_node_count() const{return _node_n;}
+    const QRPackedNode &Get_node(std::size_t i) const{
+        return *reinterpret_cast<const QRPackedNode*>(_nodes + i * _node_bytes);
+    }
+    // bytes of the image, header included
+    std::size_t Get_bytes() const{return _header ? _header->bytes : 0;}
+};
+
+// Warm start from a file written by QRPackedTree::Save. Queries are answered from the
+// mapped pages until the first write, which thaws them into a QRTree that takes over.
+class QRMappedTree{
+private:
+    std::unique_ptr<QRPackedTree> _packed;
+    std::unique_ptr<QRTree> _tree;
+
+public:
+    explicit QRMappedTree(const char *path): _packed(QRPackedTree::Open(path)){}
+
+    // false if the file could not be opened
+    bool Is_open() const{return _packed || _tree;}
+    bool Is_mapped() const{return !_tree;}
+
+    template<typename F>
+    void Query(const QRBoundingBox &bb, F &&visit, QRRefine refine = QRRefine::Box) const{
+        if(_tree)
+            _tree->Query(bb, std::forward<F>(visit), refine);
+        else if(_packed)
+            _packed->Query(bb, std::forward<F>(visit), refine);
+    }
+    void Query(const QRBoundingBox &bb, std::vector<Circle> &out, QRRefine refine = QRRefine::Box) const{
+        if(_tree)
+            _tree->Query(bb, out, refine);
+        else if(_packed)
+            _packed->Query(bb, out, refine);
+    }
+
+    // the mutable tree, thawed on first use
+    QRTree &Tree();
+    QRHandle InsertData(Circle tar){return Tree().InsertData(tar);}
+    void Delete(const QRBoundingBox &bb, QRRefine refine = QRRefine::Box){Tree().Delete(bb, refine);}
+    bool Update(QRHandle &h, Circle tar){return Tree().Update(h, tar);}
+
+    std::size_t Get_size() const{return _tree ? _tree->Get_size() : _packed ? _packed->Get_size() : 0;}
+};
+
+template<typename F>
+bool QRPackedTree::InnerVisit(std::uint32_t index, const QRBoundingBox &bb, bool exact, F &visit) const{
+    const QRPackedNode &node = Get_node(index);
+    const std::uint32_t *child = node.child();
+    std::uint64_t mask = QROverlapMask(node.arrays(), bb);
+
+    if(node.leafchild){
+        if(exact)
+            mask &= QRDiscMask(node.arrays(), bb);
+        for(; mask; mask &= mask - 1)
+            if(!visit(_leaves[child[__builtin_ctzll(mask)]]))
+                return false;
+    }
+    else{
+        for(; mask; mask &= mask - 1)
+            if(!InnerVisit(child[__builtin_ctzll(mask)], bb, exact, visit))
+                return false;
+    }
+    return true;
+}
+
+template<typename F>
+void QRPackedTree::Query(const QRBoundingBox &bb, F &&visit, QRRefine refine) const{
+    if(_node_n)
+        InnerVisit(0, bb, refine == QRRefine::Exact, visit);
+}
+
+#endif
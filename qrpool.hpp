@@ -0,0 +1,127 @@
+/*
+ *  Copyright (c) 2018 Zuoshui Zhou <zuoshui.zhou@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of version 2.1 of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#ifndef QRPOOL_HPP
+#define QRPOOL_HPP
+#include <vector>
+#include <new>
+#include <cstddef>
+#include <functional>
+#include <utility>
+
+// default number of nodes carved out of one slab
+#define QRTREE_POOL_SLAB 256
+
+// Slab allocator with free-list recycling for tree nodes.
+// Objects are constructed once when their slot is first carved and stay
+// constructed while they sit in the free list, so an Innernode keeps the
+// capacity of its child vector between uses. The caller resets the fields.
+// All slots are destroyed and all slabs freed at once by clear().
+// A slab size of 0 turns the pool into plain new/delete.
+template<typename T>
+class QRPool{
+private:
+    struct Slab{
+        T *items;
+        std::size_t size;
+        std::size_t carved;     // slots used so far
+    };
+    std::size_t _slab;
+    std::vector<Slab> _slabs;
+    std::vector<T*> _free;
+
+    void add_slab(std::size_t n){
+        _slabs.push_back(Slab{static_cast<T*>(::operator new(sizeof(T) * n)), n, 0});
+    }
+
+public:
+    explicit QRPool(std::size_t slab = QRTREE_POOL_SLAB): _slab(slab){}
+    QRPool(const QRPool&) = delete;
+    QRPool& operator=(const QRPool&) = delete;
+    ~QRPool(){clear();}
+
+    T* get(){
+        if(_slab == 0)
+            return new T();
+
+        if(!_free.empty()){
+            T* item = _free.back();
+            _free.pop_back();
+            return item;
+        }
+
+        if(_slabs.empty() || _slabs.back().carved == _slabs.back().size)
+            add_slab(_slab);
+        Slab &last = _slabs.back();
+        return new (last.items + last.carved++) T();
+    }
+
+    void put(T* item){
+        if(_slab == 0){
+            delete item;
+            return;
+        }
+        _free.push_back(item);
+    }
+
+    // the next n slots carved come from one block, one after another. What is left of
+    // the current slab stays unused
+    void reserve(std::size_t n){
+        if(_slab && n)
+            add_slab(n);
+    }
+
+    // release every node handed out so far, live or not
+    void clear(){
+        for(auto &slab: _slabs){
+            for(std::size_t j = 0; j < slab.carved; ++j)
+                slab.items[j].~T();
+            ::operator delete(slab.items);
+        }
+        _slabs.clear();
+        _free.clear();
+    }
+
+    void swap(QRPool &pool){
+        std::swap(_slab, pool._slab);
+        _slabs.swap(pool._slabs);
+        _free.swap(pool._free);
+    }
+
+    // whether item was carved here, a walk over the slabs
+    bool owns(const T *item) const{
+        std::less<const T*> less;
+        for(auto &slab: _slabs)
+            if(!less(item, slab.items) && less(item, slab.items + slab.size))
+                return true;
+        return false;
+    }
+
+    std::size_t slab() const{return _slab;}
+    // number of slots currently carved, whether in use or in the free list
+    std::size_t capacity() const{
+        std::size_t n = 0;
+        for(auto &slab: _slabs)
+            n += slab.carved;
+        return n;
+    }
+    // slots handed out and not put back
+    std::size_t live() const{return capacity() - _free.size();}
+};
+
+#endif
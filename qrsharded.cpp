@@ -0,0 +1,232 @@
+/*
+ *  Copyright (c) 2018 Zuoshui Zhou <zuoshui.zhou@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of version 2.1 of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#include <algorithm>
+#include <cassert>
+#include <utility>
+#include "qrsharded.hpp"
+
+QRShardedTree::QRShardedTree(const QRBoundingBox &bound, std::size_t shards, std::size_t s, int min_child, int max_child):
+    _bound(bound), _n(shards), _size_full(s), _min_child(min_child), _max_child(max_child),
+    _expire_batch(1), _ttl(0), _shards(new Shard[shards]){
+    assert(shards > 0 && shards <= s);
+    for(std::size_t i = 0; i < _n; ++i){
+        _shards[i].tree = NewTree(i);
+        _shards[i].load = 0;
+    }
+    Build(_bound, 0, _n, nullptr, nullptr, nullptr);
+}
+
+std::unique_ptr<QRTree> QRShardedTree::NewTree(std::size_t i) const{
+    std::unique_ptr<QRTree> tree(new QRTree(Window(i), 2, _min_child, _max_child));
+    tree->Set_expiry(_expire_batch, _ttl);
+    return tree;
+}
+
+std::uint32_t QRShardedTree::Build(const QRBoundingBox &region, std::size_t first, std::size_t k,
+    Item *begin, Item *end, std::size_t *counts){
+    const std::uint32_t at = _cuts.size();
+    _cuts.push_back(Cut{-1, 0, std::uint32_t(first), std::uint32_t(first)});
+    if(k == 1){
+        _shards[first].region = region;
+        if(counts)
+            counts[first] = end - begin;
+        return at;
+    }
+
+    // the longer side is cut, the lower k / 2 shards get their share of the centres below.
+    // Rounded down below and up above, so that no shard gets more than its window
+    const int axis = region.range[0].second - region.range[0].first >=
+        region.range[1].second - region.range[1].first ? 0 : 1;
+    const std::size_t lower = k / 2;
+    std::size_t below_window = 0, window = 0;
+    for(std::size_t i = first; i < first + k; ++i)
+        (i < first + lower ? below_window : window) += Window(i);
+    window += below_window;
+    Item *mid = begin + (end - begin) * below_window / window;
+    double cut;
+    if(begin == end)
+        cut = region.range[axis].first + (region.range[axis].second - region.range[axis].first) * lower / k;
+    else{
+        // ties with the cut fall on both sides of mid
+        std::nth_element(begin, mid, end, [axis](const Item &a, const Item &b){
+            return (axis == 0 ? a.second.x : a.second.y) < (axis == 0 ? b.second.x : b.second.y);
+        });
+        cut = axis == 0 ? mid->second.x : mid->second.y;
+    }
+
+    QRBoundingBox below = region, above = region;
+    below.range[axis].second = cut;
+    above.range[axis].first = cut;
+    const std::uint32_t b = Build(below, first, lower, begin, mid, counts);
+    const std::uint32_t a = Build(above, first + lower, k - lower, mid, end, counts);
+    _cuts[at] = Cut{axis, cut, b, a};
+    return at;
+}
+
+std::size_t QRShardedTree::Route(double x, double y) const{
+    std::uint32_t i = 0;
+    while(_cuts[i].axis >= 0)
+        i = (_cuts[i].axis == 0 ? x : y) < _cuts[i].at ? _cuts[i].below : _cuts[i].above;
+    return _cuts[i].below;
+}
+
+void QRShardedTree::InsertData(Circle tar){
+    std::shared_lock<std::shared_timed_mutex> layout(_layout);
+    Shard &shard = _shards[Route(tar.x, tar.y)];
+    std::lock_guard<std::mutex> lock(shard.lock);
+    shard.tree->InsertData(tar);
+    ++shard.load;
+}
+
+void QRShardedTree::InsertData(Circle tar, std::uint64_t stamp){
+    std::shared_lock<std::shared_timed_mutex> layout(_layout);
+    Shard &shard = _shards[Route(tar.x, tar.y)];
+    std::lock_guard<std::mutex> lock(shard.lock);
+    shard.tree->InsertData(tar, std::max(stamp, shard.tree->_stamp));
+    ++shard.load;
+}
+
+void QRShardedTree::Set_expiry(std::size_t batch, std::uint64_t ttl){
+    std::unique_lock<std::shared_timed_mutex> layout(_layout);
+    _expire_batch = batch;
+    _ttl = ttl;
+    for(std::size_t i = 0; i < _n; ++i)
+        _shards[i].tree->Set_expiry(batch, ttl);
+}
+
+void QRShardedTree::Expire(std::uint64_t now){
+    std::shared_lock<std::shared_timed_mutex> layout(_layout);
+    for(std::size_t i = 0; i < _n; ++i){
+        std::lock_guard<std::mutex> lock(_shards[i].lock);
+        _shards[i].tree->Expire(now);
+    }
+}
+
+void QRShardedTree::Delete(const QRBoundingBox &bb, QRRefine refine){
+    std::shared_lock<std::shared_timed_mutex> layout(_layout);
+    for(std::size_t i = 0; i < _n; ++i){
+        std::lock_guard<std::mutex> lock(_shards[i].lock);
+        const QRTree::Innernode *root = _shards[i].tree->Get_root();
+        if(root && root->overlaps(bb))
+            _shards[i].tree->Delete(bb, refine);
+    }
+}
+
+void QRShardedTree::Query(const QRBoundingBox &bb, std::vector<Circle> &out, QRRefine refine) const{
+    out.clear();
+    Query(bb, [&out](const Circle &cir){
+        out.push_back(cir);
+        return true;
+    }, refine);
+}
+
+std::vector<QRNeighbour> QRShardedTree::Nearest(double x, double y, std::size_t k) const{
+    std::shared_lock<std::shared_timed_mutex> layout(_layout);
+    const double p[2] = {x, y};
+    std::vector<std::pair<double, std::size_t>> order;
+    for(std::size_t i = 0; i < _n; ++i){
+        std::lock_guard<std::mutex> lock(_shards[i].lock);
+        const QRTree::Innernode *root = _shards[i].tree->Get_root();
+        if(root)
+            order.emplace_back(root->minDistance(p), i);
+    }
+    std::sort(order.begin(), order.end());
+
+    std::vector<QRNeighbour> result, found, merged;
+    QRTree::NearestQueue queue;
+    const auto closer = [](const QRNeighbour &a, const QRNeighbour &b){return a.dist < b.dist;};
+    for(const auto &o: order){
+        if(k == 0 || (result.size() == k && o.first > result.back().dist))
+            break;
+        found.clear();
+        {
+            std::lock_guard<std::mutex> lock(_shards[o.second].lock);
+            _shards[o.second].tree->Nearest(x, y, k, found, queue);
+        }
+        // both sorted, the k closest of the two
+        merged.resize(result.size() + found.size());
+        std::merge(result.begin(), result.end(), found.begin(), found.end(), merged.begin(), closer);
+        if(merged.size() > k)
+            merged.resize(k);
+        result.swap(merged);
+    }
+    return result;
+}
+
+void QRShardedTree::Rebalance(){
+    std::unique_lock<std::shared_timed_mutex> layout(_layout);
+
+    std::vector<Item> items;
+    for(std::size_t i = 0; i < _n; ++i)
+        for(const QRTree::Leafnode *leaf = _shards[i].tree->front; leaf; leaf = leaf->next)
+            items.emplace_back(leaf->stamp, leaf->cir);
+
+    // the items go to the shards by where Build leaves them, not by Route, which would
+    // send every centre on a cut above it
+    std::vector<std::size_t> counts(_n);
+    _cuts.clear();
+    Build(_bound, 0, _n, items.data(), items.data() + items.size(), counts.data());
+
+    // each shard packed at once from its own circles, oldest first
+    Item *begin = items.data();
+    for(std::size_t i = 0; i < _n; ++i){
+        Item *end = begin + counts[i];
+        assert(counts[i] <= Window(i));
+        std::sort(begin, end, [](const Item &a, const Item &b){return a.first < b.first;});
+        std::vector<Circle> data;
+        std::vector<std::uint64_t> stamps;
+        data.reserve(counts[i]);
+        stamps.reserve(counts[i]);
+        for(const Item *item = begin; item != end; ++item){
+            data.push_back(item->second);
+            stamps.push_back(item->first);
+        }
+        _shards[i].tree = NewTree(i);
+        _shards[i].tree->BulkLoad(std::move(data), QRPacking::STR, stamps.data());
+        _shards[i].load = 0;
+        begin = end;
+    }
+}
+
+double QRShardedTree::Get_skew() const{
+    std::shared_lock<std::shared_timed_mutex> layout(_layout);
+    std::size_t total = 0, most = 0;
+    for(std::size_t i = 0; i < _n; ++i){
+        std::lock_guard<std::mutex> lock(_shards[i].lock);
+        total += _shards[i].load;
+        most = std::max(most, _shards[i].load);
+    }
+    return total == 0 ? 1 : double(most) * _n / total;
+}
+
+std::size_t QRShardedTree::Get_size() const{
+    std::shared_lock<std::shared_timed_mutex> layout(_layout);
+    std::size_t n = 0;
+    for(std::size_t i = 0; i < _n; ++i){
+        std::lock_guard<std::mutex> lock(_shards[i].lock);
+        n += _shards[i].tree->Get_size();
+    }
+    return n;
+}
+
+QRBoundingBox QRShardedTree::Get_region(std::size_t i) const{
+    std::shared_lock<std::shared_timed_mutex> layout(_layout);
+    assert(i < _n);
+    return _shards[i].region;
+}
@@ -0,0 +1,125 @@
+/*
+ *  Copyright (c) 2018 Zuoshui Zhou <zuoshui.zhou@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of version 2.1 of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#ifndef QRSHARDED_HPP
+#define QRSHARDED_HPP
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <utility>
+#include <vector>
+#include "qrtree.hpp"
+
+// Space cut into shards by a k-d tree of cuts, each shard a QRTree with its own lock and
+// share of the FIFO window s, so that writers to different shards run at once. For the
+// default 2-D double tree only.
+// A circle belongs to the shard that holds its centre, its box may reach into the others.
+// Queries, deletes and nearest neighbours go to every shard whose tree box touches them,
+// so a circle crossing a cut is neither missed nor found twice.
+class QRShardedTree{
+private:
+    struct alignas(64) Shard{
+        std::mutex lock;
+        std::unique_ptr<QRTree> tree;
+        QRBoundingBox region;
+        // inserts since the last Rebalance
+        std::size_t load;
+    };
+    // a leaf with its stamp, as Rebalance moves it
+    typedef std::pair<std::uint64_t, Circle> Item;
+    // a cut at at along axis between two subtrees of cuts, or with axis -1 the shard below
+    struct Cut{
+        int axis;
+        double at;
+        std::uint32_t below;
+        std::uint32_t above;
+    };
+
+    QRBoundingBox _bound;
+    std::size_t _n;
+    std::size_t _size_full;
+    int _min_child;
+    int _max_child;
+    std::size_t _expire_batch;
+    std::uint64_t _ttl;
+
+    std::unique_ptr<Shard[]> _shards;
+    std::vector<Cut> _cuts;
+    // shared by every call, Rebalance alone takes it for itself
+    mutable std::shared_timed_mutex _layout;
+
+    std::size_t Route(double x, double y) const;
+    // cuts for the k shards from first over region, at the quantiles of the centres in
+    // [begin, end) weighted by the windows of the shards, or evenly without any. The items
+    // are left in shard order, counts[i] of them for shard i
+    std::uint32_t Build(const QRBoundingBox &region, std::size_t first, std::size_t k,
+        Item *begin, Item *end, std::size_t *counts);
+    // s / shards, the first s % shards one more
+    std::size_t Window(std::size_t i) const{return _size_full / _n + (i < _size_full % _n ? 1 : 0);}
+    std::unique_ptr<QRTree> NewTree(std::size_t i) const;
+
+public:
+    QRShardedTree(const QRBoundingBox &bound, std::size_t shards, std::size_t s, int min_child = 10, int max_child = 20);
+    QRShardedTree(const QRShardedTree&) = delete;
+    QRShardedTree& operator=(const QRShardedTree&) = delete;
+
+    // from any number of threads at once. A stamp older than the last one of its shard
+    // is taken as that one
+    void InsertData(Circle tar);
+    void InsertData(Circle tar, std::uint64_t stamp);
+    // as QRTree::Set_expiry and Expire, for every shard
+    void Set_expiry(std::size_t batch, std::uint64_t ttl = 0);
+    void Expire(std::uint64_t now);
+    void Delete(const QRBoundingBox &bb, QRRefine refine = QRRefine::Box);
+
+    // visit is called with the shard locked, returning false stops the query
+    template<typename F>
+    void Query(const QRBoundingBox &bb, F &&visit, QRRefine refine = QRRefine::Box) const;
+    void Query(const QRBoundingBox &bb, std::vector<Circle> &out, QRRefine refine = QRRefine::Box) const;
+    // the shards in order of their distance, up to the first farther than the k-th found
+    std::vector<QRNeighbour> Nearest(double x, double y, std::size_t k) const;
+
+    // Cuts space again at the quantiles of the centres held, so that each shard gets its
+    // share, and moves the circles with their stamps. Centres tied at a cut go to either
+    // side, no circle is lost. Stops every other call meanwhile
+    void Rebalance();
+    // inserts into the busiest shard since the last Rebalance over the mean, 1 if even
+    double Get_skew() const;
+
+    std::size_t Get_size() const;
+    std::size_t Get_shard_count() const{return _n;}
+    QRBoundingBox Get_region(std::size_t i) const;
+};
+
+template<typename F>
+void QRShardedTree::Query(const QRBoundingBox &bb, F &&visit, QRRefine refine) const{
+    std::shared_lock<std::shared_timed_mutex> layout(_layout);
+    bool go = true;
+    for(std::size_t i = 0; i < _n && go; ++i){
+        Shard &shard = _shards[i];
+        std::lock_guard<std::mutex> lock(shard.lock);
+        const QRTree::Innernode *root = shard.tree->Get_root();
+        if(root && root->overlaps(bb))
+            shard.tree->Query(bb, [&visit, &go](const Circle &cir){
+                return go = visit(cir);
+            }, refine);
+    }
+}
+
+#endif
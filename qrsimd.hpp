@@ -0,0 +1,356 @@
+/*
+ *  Copyright (c) 2018 Zuoshui Zhou <zuoshui.zhou@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of version 2.1 of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+/*
+ *  Kernels over child boxes stored as structure of arrays, lo[axis][i] and hi[axis][i].
+ *  The templates serve any Dim and Scalar. The 2-D double overloads take over for the
+ *  default tree: AVX works on four boxes at once, SSE2 on two, the scalar loop takes
+ *  the rest. Which one is compiled in depends on the target flags, e.g. -mavx2 or
+ *  -march=native.
+ */
+
+#ifndef QRSIMD_HPP
+#define QRSIMD_HPP
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <vector>
+#include "qrnode.hpp"
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// child boxes of one node, the masks below take at most 64 of them
+template<int Dim, typename Scalar>
+struct QRBasicBoxArrays{
+    const Scalar *lo[Dim];
+    const Scalar *hi[Dim];
+    std::size_t n;
+};
+
+// children of a mutable node gathered into arrays for the kernels, reused between calls
+template<int Dim, typename Scalar>
+struct QRBasicChildBoxes{
+    std::vector<Scalar> lo[Dim], hi[Dim];
+    std::vector<Scalar> value;          // per child result of a kernel
+    std::vector<std::uint32_t> order;   // 0..n-1, for sorting children by value
+
+    void gather(const std::vector<QRBasicBox<Dim, Scalar>*> &child){
+        const std::size_t n = child.size();
+        for(int d = 0; d < Dim; ++d){
+            lo[d].resize(n);
+            hi[d].resize(n);
+        }
+        value.resize(n);
+        order.resize(n);
+        for(std::size_t i = 0; i < n; ++i){
+            for(int d = 0; d < Dim; ++d){
+                lo[d][i] = child[i]->range[d].first;
+                hi[d][i] = child[i]->range[d].second;
+            }
+            order[i] = i;
+        }
+    }
+
+    QRBasicBoxArrays<Dim, Scalar> arrays() const{
+        QRBasicBoxArrays<Dim, Scalar> b;
+        for(int d = 0; d < Dim; ++d){
+            b.lo[d] = lo[d].data();
+            b.hi[d] = hi[d].data();
+        }
+        b.n = order.size();
+        return b;
+    }
+};
+
+typedef QRBasicBoxArrays<2, double> QRBoxArrays;
+typedef QRBasicChildBoxes<2, double> QRChildBoxes;
+
+// bit i set if box i overlaps bb, same closed test as QRBasicBox::overlaps
+template<int Dim, typename Scalar>
+inline std::uint64_t QROverlapMask(const QRBasicBoxArrays<Dim, Scalar> &b, const QRBasicBox<Dim, Scalar> &bb){
+    std::uint64_t mask = 0;
+    for(std::size_t i = 0; i < b.n; ++i){
+        bool hit = true;
+        for(int d = 0; d < Dim; ++d)
+            hit &= b.lo[d][i] <= bb.range[d].second && b.hi[d][i] >= bb.range[d].first;
+        mask |= (std::uint64_t)hit << i;
+    }
+    return mask;
+}
+
+// out[i] = area of box i expanded to contain bb, minus the area of box i
+template<int Dim, typename Scalar>
+inline void QRAreaEnlargement(const QRBasicBoxArrays<Dim, Scalar> &b, const QRBasicBox<Dim, Scalar> &bb, Scalar *out){
+    for(std::size_t i = 0; i < b.n; ++i){
+        Scalar area = 1, grown = 1;
+        for(int d = 0; d < Dim; ++d){
+            area *= b.hi[d][i] - b.lo[d][i];
+            grown *= std::max(b.hi[d][i], bb.range[d].second) - std::min(b.lo[d][i], bb.range[d].first);
+        }
+        out[i] = grown - area;
+    }
+}
+
+// sum over i of the overlap area of box i and bb
+template<int Dim, typename Scalar>
+inline Scalar QROverlapAreaSum(const QRBasicBoxArrays<Dim, Scalar> &b, const QRBasicBox<Dim, Scalar> &bb){
+    Scalar sum = 0;
+    for(std::size_t i = 0; i < b.n; ++i){
+        Scalar area = 1;
+        for(int d = 0; d < Dim; ++d)
+            area *= std::max(std::min(b.hi[d][i], bb.range[d].second) - std::max(b.lo[d][i], bb.range[d].first), Scalar(0));
+        sum += area;
+    }
+    return sum;
+}
+
+// the same kernels for 2-D double boxes, preferred by overload resolution over the templates
+inline std::uint64_t QROverlapMask(const QRBoxArrays &b, const QRBoundingBox &bb){
+    std::uint64_t mask = 0;
+    std::size_t i = 0;
+#if defined(__AVX__)
+    const __m256d qminx = _mm256_set1_pd(bb.range[0].first), qmaxx = _mm256_set1_pd(bb.range[0].second);
+    const __m256d qminy = _mm256_set1_pd(bb.range[1].first), qmaxy = _mm256_set1_pd(bb.range[1].second);
+    for(; i + 4 <= b.n; i += 4){
+        __m256d m = _mm256_and_pd(_mm256_cmp_pd(_mm256_loadu_pd(b.lo[0] + i), qmaxx, _CMP_LE_OQ),
+                                  _mm256_cmp_pd(_mm256_loadu_pd(b.hi[0] + i), qminx, _CMP_GE_OQ));
+        m = _mm256_and_pd(m, _mm256_cmp_pd(_mm256_loadu_pd(b.lo[1] + i), qmaxy, _CMP_LE_OQ));
+        m = _mm256_and_pd(m, _mm256_cmp_pd(_mm256_loadu_pd(b.hi[1] + i), qminy, _CMP_GE_OQ));
+        mask |= (std::uint64_t)_mm256_movemask_pd(m) << i;
+    }
+#elif defined(__SSE2__)
+    const __m128d qminx = _mm_set1_pd(bb.range[0].first), qmaxx = _mm_set1_pd(bb.range[0].second);
+    const __m128d qminy = _mm_set1_pd(bb.range[1].first), qmaxy = _mm_set1_pd(bb.range[1].second);
+    for(; i + 2 <= b.n; i += 2){
+        __m128d m = _mm_and_pd(_mm_cmple_pd(_mm_loadu_pd(b.lo[0] + i), qmaxx),
+                               _mm_cmpge_pd(_mm_loadu_pd(b.hi[0] + i), qminx));
+        m = _mm_and_pd(m, _mm_cmple_pd(_mm_loadu_pd(b.lo[1] + i), qmaxy));
+        m = _mm_and_pd(m, _mm_cmpge_pd(_mm_loadu_pd(b.hi[1] + i), qminy));
+        mask |= (std::uint64_t)_mm_movemask_pd(m) << i;
+    }
+#endif
+    for(; i < b.n; ++i)
+        if(b.lo[0][i] <= bb.range[0].second && b.hi[0][i] >= bb.range[0].first &&
+           b.lo[1][i] <= bb.range[1].second && b.hi[1][i] >= bb.range[1].first)
+            mask |= (std::uint64_t)1 << i;
+    return mask;
+}
+
+// bit i set if the disc inscribed in square i overlaps bb, as DiscOverlapsBox does for a leaf
+inline std::uint64_t QRDiscMask(const QRBoxArrays &b, const QRBoundingBox &bb){
+    std::uint64_t mask = 0;
+    std::size_t i = 0;
+#if defined(__AVX__)
+    const __m256d qminx = _mm256_set1_pd(bb.range[0].first), qmaxx = _mm256_set1_pd(bb.range[0].second);
+    const __m256d qminy = _mm256_set1_pd(bb.range[1].first), qmaxy = _mm256_set1_pd(bb.range[1].second);
+    const __m256d half = _mm256_set1_pd(0.5);
+    for(; i + 4 <= b.n; i += 4){
+        const __m256d x0 = _mm256_loadu_pd(b.lo[0] + i), x1 = _mm256_loadu_pd(b.hi[0] + i);
+        const __m256d y0 = _mm256_loadu_pd(b.lo[1] + i), y1 = _mm256_loadu_pd(b.hi[1] + i);
+        const __m256d cx = _mm256_mul_pd(_mm256_add_pd(x0, x1), half);
+        const __m256d cy = _mm256_mul_pd(_mm256_add_pd(y0, y1), half);
+        const __m256d r = _mm256_mul_pd(_mm256_sub_pd(x1, x0), half);
+        const __m256d dx = _mm256_sub_pd(cx, _mm256_min_pd(_mm256_max_pd(cx, qminx), qmaxx));
+        const __m256d dy = _mm256_sub_pd(cy, _mm256_min_pd(_mm256_max_pd(cy, qminy), qmaxy));
+        const __m256d d2 = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+        mask |= (std::uint64_t)_mm256_movemask_pd(_mm256_cmp_pd(d2, _mm256_mul_pd(r, r), _CMP_LE_OQ)) << i;
+    }
+#elif defined(__SSE2__)
+    const __m128d qminx = _mm_set1_pd(bb.range[0].first), qmaxx = _mm_set1_pd(bb.range[0].second);
+    const __m128d qminy = _mm_set1_pd(bb.range[1].first), qmaxy = _mm_set1_pd(bb.range[1].second);
+    const __m128d half = _mm_set1_pd(0.5);
+    for(; i + 2 <= b.n; i += 2){
+        const __m128d x0 = _mm_loadu_pd(b.lo[0] + i), x1 = _mm_loadu_pd(b.hi[0] + i);
+        const __m128d y0 = _mm_loadu_pd(b.lo[1] + i), y1 = _mm_loadu_pd(b.hi[1] + i);
+        const __m128d cx = _mm_mul_pd(_mm_add_pd(x0, x1), half);
+        const __m128d cy = _mm_mul_pd(_mm_add_pd(y0, y1), half);
+        const __m128d r = _mm_mul_pd(_mm_sub_pd(x1, x0), half);
+        const __m128d dx = _mm_sub_pd(cx, _mm_min_pd(_mm_max_pd(cx, qminx), qmaxx));
+        const __m128d dy = _mm_sub_pd(cy, _mm_min_pd(_mm_max_pd(cy, qminy), qmaxy));
+        const __m128d d2 = _mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy));
+        mask |= (std::uint64_t)_mm_movemask_pd(_mm_cmple_pd(d2, _mm_mul_pd(r, r))) << i;
+    }
+#endif
+    for(; i < b.n; ++i){
+        const double cx = (b.lo[0][i] + b.hi[0][i]) * 0.5, cy = (b.lo[1][i] + b.hi[1][i]) * 0.5;
+        const double r = (b.hi[0][i] - b.lo[0][i]) * 0.5;
+        const double dx = cx - std::min(std::max(cx, bb.range[0].first), bb.range[0].second);
+        const double dy = cy - std::min(std::max(cy, bb.range[1].first), bb.range[1].second);
+        if(dx * dx + dy * dy <= r * r)
+            mask |= (std::uint64_t)1 << i;
+    }
+    return mask;
+}
+
+// out[i] = area of box i expanded to contain bb, minus the area of box i
+inline void QRAreaEnlargement(const QRBoxArrays &b, const QRBoundingBox &bb, double *out){
+    std::size_t i = 0;
+#if defined(__AVX__)
+    const __m256d qminx = _mm256_set1_pd(bb.range[0].first), qmaxx = _mm256_set1_pd(bb.range[0].second);
+    const __m256d qminy = _mm256_set1_pd(bb.range[1].first), qmaxy = _mm256_set1_pd(bb.range[1].second);
+    for(; i + 4 <= b.n; i += 4){
+        const __m256d x0 = _mm256_loadu_pd(b.lo[0] + i), x1 = _mm256_loadu_pd(b.hi[0] + i);
+        const __m256d y0 = _mm256_loadu_pd(b.lo[1] + i), y1 = _mm256_loadu_pd(b.hi[1] + i);
+        const __m256d area = _mm256_mul_pd(_mm256_sub_pd(x1, x0), _mm256_sub_pd(y1, y0));
+        const __m256d grown = _mm256_mul_pd(_mm256_sub_pd(_mm256_max_pd(x1, qmaxx), _mm256_min_pd(x0, qminx)),
+                                            _mm256_sub_pd(_mm256_max_pd(y1, qmaxy), _mm256_min_pd(y0, qminy)));
+        _mm256_storeu_pd(out + i, _mm256_sub_pd(grown, area));
+    }
+#elif defined(__SSE2__)
+    const __m128d qminx = _mm_set1_pd(bb.range[0].first), qmaxx = _mm_set1_pd(bb.range[0].second);
+    const __m128d qminy = _mm_set1_pd(bb.range[1].first), qmaxy = _mm_set1_pd(bb.range[1].second);
+    for(; i + 2 <= b.n; i += 2){
+        const __m128d x0 = _mm_loadu_pd(b.lo[0] + i), x1 = _mm_loadu_pd(b.hi[0] + i);
+        const __m128d y0 = _mm_loadu_pd(b.lo[1] + i), y1 = _mm_loadu_pd(b.hi[1] + i);
+        const __m128d area = _mm_mul_pd(_mm_sub_pd(x1, x0), _mm_sub_pd(y1, y0));
+        const __m128d grown = _mm_mul_pd(_mm_sub_pd(_mm_max_pd(x1, qmaxx), _mm_min_pd(x0, qminx)),
+                                         _mm_sub_pd(_mm_max_pd(y1, qmaxy), _mm_min_pd(y0, qminy)));
+        _mm_storeu_pd(out + i, _mm_sub_pd(grown, area));
+    }
+#endif
+    for(; i < b.n; ++i){
+        const double area = (b.hi[0][i] - b.lo[0][i]) * (b.hi[1][i] - b.lo[1][i]);
+        out[i] = (std::max(b.hi[0][i], bb.range[0].second) - std::min(b.lo[0][i], bb.range[0].first)) *
+                 (std::max(b.hi[1][i], bb.range[1].second) - std::min(b.lo[1][i], bb.range[1].first)) - area;
+    }
+}
+
+// sum over i of the overlap area of box i and bb
+inline double QROverlapAreaSum(const QRBoxArrays &b, const QRBoundingBox &bb){
+    double sum = 0.0;
+    std::size_t i = 0;
+#if defined(__AVX__)
+    const __m256d qminx = _mm256_set1_pd(bb.range[0].first), qmaxx = _mm256_set1_pd(bb.range[0].second);
+    const __m256d qminy = _mm256_set1_pd(bb.range[1].first), qmaxy = _mm256_set1_pd(bb.range[1].second);
+    const __m256d zero = _mm256_setzero_pd();
+    __m256d acc = zero;
+    for(; i + 4 <= b.n; i += 4){
+        const __m256d w = _mm256_max_pd(_mm256_sub_pd(_mm256_min_pd(_mm256_loadu_pd(b.hi[0] + i), qmaxx),
+                                                      _mm256_max_pd(_mm256_loadu_pd(b.lo[0] + i), qminx)), zero);
+        const __m256d h = _mm256_max_pd(_mm256_sub_pd(_mm256_min_pd(_mm256_loadu_pd(b.hi[1] + i), qmaxy),
+                                                      _mm256_max_pd(_mm256_loadu_pd(b.lo[1] + i), qminy)), zero);
+        acc = _mm256_add_pd(acc, _mm256_mul_pd(w, h));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, acc);
+    sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#elif defined(__SSE2__)
+    const __m128d qminx = _mm_set1_pd(bb.range[0].first), qmaxx = _mm_set1_pd(bb.range[0].second);
+    const __m128d qminy = _mm_set1_pd(bb.range[1].first), qmaxy = _mm_set1_pd(bb.range[1].second);
+    const __m128d zero = _mm_setzero_pd();
+    __m128d acc = zero;
+    for(; i + 2 <= b.n; i += 2){
+        const __m128d w = _mm_max_pd(_mm_sub_pd(_mm_min_pd(_mm_loadu_pd(b.hi[0] + i), qmaxx),
+                                                _mm_max_pd(_mm_loadu_pd(b.lo[0] + i), qminx)), zero);
+        const __m128d h = _mm_max_pd(_mm_sub_pd(_mm_min_pd(_mm_loadu_pd(b.hi[1] + i), qmaxy),
+                                                _mm_max_pd(_mm_loadu_pd(b.lo[1] + i), qminy)), zero);
+        acc = _mm_add_pd(acc, _mm_mul_pd(w, h));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, acc);
+    sum = lanes[0] + lanes[1];
+#endif
+    for(; i < b.n; ++i){
+        const double w = std::min(b.hi[0][i], bb.range[0].second) - std::max(b.lo[0][i], bb.range[0].first);
+        const double h = std::min(b.hi[1][i], bb.range[1].second) - std::max(b.lo[1][i], bb.range[1].first);
+        if(w > 0 && h > 0)
+            sum += w * h;
+    }
+    return sum;
+}
+
+// and for 2-D float boxes, eight to a register with AVX, four with SSE
+inline void QRAreaEnlargement(const QRBasicBoxArrays<2, float> &b, const QRBasicBox<2, float> &bb, float *out){
+    std::size_t i = 0;
+#if defined(__AVX__)
+    const __m256 qminx = _mm256_set1_ps(bb.range[0].first), qmaxx = _mm256_set1_ps(bb.range[0].second);
+    const __m256 qminy = _mm256_set1_ps(bb.range[1].first), qmaxy = _mm256_set1_ps(bb.range[1].second);
+    for(; i + 8 <= b.n; i += 8){
+        const __m256 x0 = _mm256_loadu_ps(b.lo[0] + i), x1 = _mm256_loadu_ps(b.hi[0] + i);
+        const __m256 y0 = _mm256_loadu_ps(b.lo[1] + i), y1 = _mm256_loadu_ps(b.hi[1] + i);
+        const __m256 area = _mm256_mul_ps(_mm256_sub_ps(x1, x0), _mm256_sub_ps(y1, y0));
+        const __m256 grown = _mm256_mul_ps(_mm256_sub_ps(_mm256_max_ps(x1, qmaxx), _mm256_min_ps(x0, qminx)),
+                                           _mm256_sub_ps(_mm256_max_ps(y1, qmaxy), _mm256_min_ps(y0, qminy)));
+        _mm256_storeu_ps(out + i, _mm256_sub_ps(grown, area));
+    }
+#elif defined(__SSE2__)
+    const __m128 qminx = _mm_set1_ps(bb.range[0].first), qmaxx = _mm_set1_ps(bb.range[0].second);
+    const __m128 qminy = _mm_set1_ps(bb.range[1].first), qmaxy = _mm_set1_ps(bb.range[1].second);
+    for(; i + 4 <= b.n; i += 4){
+        const __m128 x0 = _mm_loadu_ps(b.lo[0] + i), x1 = _mm_loadu_ps(b.hi[0] + i);
+        const __m128 y0 = _mm_loadu_ps(b.lo[1] + i), y1 = _mm_loadu_ps(b.hi[1] + i);
+        const __m128 area = _mm_mul_ps(_mm_sub_ps(x1, x0), _mm_sub_ps(y1, y0));
+        const __m128 grown = _mm_mul_ps(_mm_sub_ps(_mm_max_ps(x1, qmaxx), _mm_min_ps(x0, qminx)),
+                                        _mm_sub_ps(_mm_max_ps(y1, qmaxy), _mm_min_ps(y0, qminy)));
+        _mm_storeu_ps(out + i, _mm_sub_ps(grown, area));
+    }
+#endif
+    for(; i < b.n; ++i){
+        const float area = (b.hi[0][i] - b.lo[0][i]) * (b.hi[1][i] - b.lo[1][i]);
+        out[i] = (std::max(b.hi[0][i], bb.range[0].second) - std::min(b.lo[0][i], bb.range[0].first)) *
+                 (std::max(b.hi[1][i], bb.range[1].second) - std::min(b.lo[1][i], bb.range[1].first)) - area;
+    }
+}
+
+inline float QROverlapAreaSum(const QRBasicBoxArrays<2, float> &b, const QRBasicBox<2, float> &bb){
+    float sum = 0.0f;
+    std::size_t i = 0;
+#if defined(__AVX__)
+    const __m256 qminx = _mm256_set1_ps(bb.range[0].first), qmaxx = _mm256_set1_ps(bb.range[0].second);
+    const __m256 qminy = _mm256_set1_ps(bb.range[1].first), qmaxy = _mm256_set1_ps(bb.range[1].second);
+    const __m256 zero = _mm256_setzero_ps();
+    __m256 acc = zero;
+    for(; i + 8 <= b.n; i += 8){
+        const __m256 w = _mm256_max_ps(_mm256_sub_ps(_mm256_min_ps(_mm256_loadu_ps(b.hi[0] + i), qmaxx),
+                                                     _mm256_max_ps(_mm256_loadu_ps(b.lo[0] + i), qminx)), zero);
+        const __m256 h = _mm256_max_ps(_mm256_sub_ps(_mm256_min_ps(_mm256_loadu_ps(b.hi[1] + i), qmaxy),
+                                                     _mm256_max_ps(_mm256_loadu_ps(b.lo[1] + i), qminy)), zero);
+        acc = _mm256_add_ps(acc, _mm256_mul_ps(w, h));
+    }
+    float lanes[8];
+    _mm256_storeu_ps(lanes, acc);
+    for(int j = 0; j < 8; ++j)
+        sum += lanes[j];
+#elif defined(__SSE2__)
+    const __m128 qminx = _mm_set1_ps(bb.range[0].first), qmaxx = _mm_set1_ps(bb.range[0].second);
+    const __m128 qminy = _mm_set1_ps(bb.range[1].first), qmaxy = _mm_set1_ps(bb.range[1].second);
+    const __m128 zero = _mm_setzero_ps();
+    __m128 acc = zero;
+    for(; i + 4 <= b.n; i += 4){
+        const __m128 w = _mm_max_ps(_mm_sub_ps(_mm_min_ps(_mm_loadu_ps(b.hi[0] + i), qmaxx),
+                                               _mm_max_ps(_mm_loadu_ps(b.lo[0] + i), qminx)), zero);
+        const __m128 h = _mm_max_ps(_mm_sub_ps(_mm_min_ps(_mm_loadu_ps(b.hi[1] + i), qmaxy),
+                                               _mm_max_ps(_mm_loadu_ps(b.lo[1] + i), qminy)), zero);
+        acc = _mm_add_ps(acc, _mm_mul_ps(w, h));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, acc);
+    sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+    for(; i < b.n; ++i){
+        const float w = std::min(b.hi[0][i], bb.range[0].second) - std::max(b.lo[0][i], bb.range[0].first);
+        const float h = std::min(b.hi[1][i], bb.range[1].second) - std::max(b.lo[1][i], bb.range[1].first);
+        if(w > 0 && h > 0)
+            sum += w * h;
+    }
+    return sum;
+}
+
+#endif
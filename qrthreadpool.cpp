@@ -0,0 +1,136 @@
+/*
+ *  Copyright (c) 2018 Zuoshui Zhou <zuoshui.zhou@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of version 2.1 of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#include <algorithm>
+#include "qrthreadpool.hpp"
+
+QRThreadPool::QRThreadPool(unsigned threads):
+    _n(threads ? threads : std::max(1u, std::thread::hardware_concurrency())),
+    _shares(new Share[_n]), _generation(0), _running(0), _quit(false),
+    _job(nullptr), _context(nullptr), _grain(1){
+    for(unsigned i = 0; i < _n; ++i)
+        _shares[i].begin = _shares[i].end = 0;
+    for(unsigned i = 1; i < _n; ++i)
+        _threads.emplace_back(&QRThreadPool::Loop, this, i);
+}
+
+QRThreadPool::~QRThreadPool(){
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _quit = true;
+    }
+    _wake.notify_all();
+    for(auto &t: _threads)
+        t.join();
+}
+
+void QRThreadPool::Run(std::size_t n, std::size_t grain, Job job, void *context){
+    std::lock_guard<std::mutex> job_guard(_job_lock);
+    if(n == 0)
+        return;
+
+    _job = job;
+    _context = context;
+    _grain = std::max<std::size_t>(grain, 1);
+    for(unsigned i = 0; i < _n; ++i){
+        std::lock_guard<std::mutex> guard(_shares[i].lock);
+        _shares[i].begin = n * i / _n;
+        _shares[i].end = n * (i + 1) / _n;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        ++_generation;
+        _running = _n - 1;
+    }
+    _wake.notify_all();
+
+    Work(0);
+
+    std::unique_lock<std::mutex> guard(_lock);
+    _done.wait(guard, [this]{return _running == 0;});
+}
+
+void QRThreadPool::Loop(unsigned thread){
+    std::uint64_t seen = 0;
+    for(;;){
+        {
+            std::unique_lock<std::mutex> guard(_lock);
+            _wake.wait(guard, [&]{return _quit || _generation != seen;});
+            if(_quit)
+                return;
+            seen = _generation;
+        }
+
+        Work(thread);
+
+        std::lock_guard<std::mutex> guard(_lock);
+        if(--_running == 0)
+            _done.notify_one();
+    }
+}
+
+void QRThreadPool::Work(unsigned thread){
+    Share &own = _shares[thread];
+    for(;;){
+        std::size_t begin, end;
+        {
+            std::lock_guard<std::mutex> guard(own.lock);
+            begin = own.begin;
+            end = std::min(own.end, begin + _grain);
+            own.begin = end;
+        }
+        if(begin < end)
+            _job(_context, begin, end, thread);
+        else if(!Steal(thread))
+            return;
+    }
+}
+
+// moves the back half of the largest share left to this thread's own, false if all are done
+bool QRThreadPool::Steal(unsigned thread){
+    for(;;){
+        unsigned victim = thread;
+        std::size_t most = 0;
+        for(unsigned i = 0; i < _n; ++i){
+            std::lock_guard<std::mutex> guard(_shares[i].lock);
+            if(_shares[i].end - _shares[i].begin > most){
+                most = _shares[i].end - _shares[i].begin;
+                victim = i;
+            }
+        }
+        if(most == 0)
+            return false;
+
+        std::size_t begin, end;
+        {
+            std::lock_guard<std::mutex> guard(_shares[victim].lock);
+            const std::size_t left = _shares[victim].end - _shares[victim].begin;
+            // taken by someone else meanwhile, look again
+            if(left == 0)
+                continue;
+            end = _shares[victim].end;
+            begin = left <= _grain ? _shares[victim].begin : end - left / 2;
+            _shares[victim].end = begin;
+        }
+        std::lock_guard<std::mutex> guard(_shares[thread].lock);
+        _shares[thread].begin = begin;
+        _shares[thread].end = end;
+        return true;
+    }
+}
@@ -0,0 +1,85 @@
+/*
+ *  Copyright (c) 2018 Zuoshui Zhou <zuoshui.zhou@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of version 2.1 of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#ifndef QRTHREADPOOL_HPP
+#define QRTHREADPOOL_HPP
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Work-stealing pool for loops over an index range. Each thread starts on an even share
+// of the range and takes grain indices at a time from its front. A thread that runs dry
+// steals the back half of the largest share left. The calling thread works as thread 0.
+class QRThreadPool{
+private:
+    struct alignas(64) Share{
+        std::mutex lock;
+        std::size_t begin;
+        std::size_t end;
+    };
+
+    typedef void (*Job)(void *context, std::size_t begin, std::size_t end, unsigned thread);
+
+    unsigned _n;
+    std::unique_ptr<Share[]> _shares;
+    std::vector<std::thread> _threads;
+
+    std::mutex _lock;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    std::uint64_t _generation;
+    unsigned _running;
+    bool _quit;
+
+    // the loop being run
+    std::mutex _job_lock;
+    Job _job;
+    void *_context;
+    std::size_t _grain;
+
+    void Loop(unsigned thread);
+    void Work(unsigned thread);
+    bool Steal(unsigned thread);
+    void Run(std::size_t n, std::size_t grain, Job job, void *context);
+
+public:
+    // 0 threads for one per hardware thread
+    explicit QRThreadPool(unsigned threads = 0);
+    QRThreadPool(const QRThreadPool&) = delete;
+    QRThreadPool& operator=(const QRThreadPool&) = delete;
+    ~QRThreadPool();
+
+    // calls fn(begin, end, thread) on pieces of [0, n) of at most grain indices until all
+    // of it is done, thread being 0 .. Get_size() - 1. One loop at a time per pool.
+    template<typename F>
+    void ParallelFor(std::size_t n, std::size_t grain, F &&fn){
+        typedef typename std::remove_reference<F>::type Fn;
+        Run(n, grain, [](void *context, std::size_t begin, std::size_t end, unsigned thread){
+            (*static_cast<Fn*>(context))(begin, end, thread);
+        }, const_cast<void*>(static_cast<const void*>(&fn)));
+    }
+
+    unsigned Get_size() const{return _n;}
+};
+
+#endif
@@ -26,16 +26,327 @@
 #include <cassert>
 #include <stack>
 #include <queue>
+#include <cmath>
+#include <cstdint>
+#include <array>
+#include <type_traits>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <list>
+#include <unordered_map>
 #include "qrnode.hpp"
+#include "qrpool.hpp"
+#include "qrsimd.hpp"
+#include "qrepoch.hpp"
+#include "qrthreadpool.hpp"
 
 #define QRTREE_REINSERT_P 0.30
 #define QRTREE_CHOOSE_SUBTREE_P 32
+// a moved payload may grow the box of its parent by this share of its area, beyond
+// that it is reinserted
+#define QRTREE_UPDATE_GROWTH 0.1
+
+// queries add what they walked to the counters of Stats(), 0 leaves that out
+#define QRTREE_STATS 1
+// the query counters are split into this many cache lines, each thread adds to its own
+#define QRTREE_STATS_STRIPES 16
+
+// deepest tree a query iterator can walk, far beyond any tree that fits in memory
+#define QRTREE_MAX_HEIGHT 32
+
+// how leaves are matched against a query window
+enum class QRRefine{
+    Box,        // the bounding box of the payload overlaps the window
+    Exact       // the payload itself overlaps the window, e.g. the disc of a Circle
+};
+
+// packing order used by the bulk-load constructor
+enum class QRPacking{
+    STR,        // Sort-Tile-Recursive
+    Hilbert     // Hilbert curve order of the centres
+};
+
+// how an overflowing node is split, see QRBasicTree::Set_strategy
+enum class QRSplit{
+    RStar,      // R*: axis of least margin, then distribution of least overlap. Forced reinsertion first
+    Quadratic,  // Guttman's quadratic split, no reinsertion
+    Linear      // Guttman's linear split, no reinsertion
+};
+
+// how an insert picks the child to go down into
+enum class QRChoose{
+    RStar,      // least overlap enlargement above the leaves, see QRTREE_CHOOSE_SUBTREE_P
+    Revised,    // revised R*-tree: a child holding the box, else by perimeter with an early out
+    Area        // least area enlargement, as Guttman's
+};
+
+// what a payload did with respect to a standing query, see QRBasicTree::Subscribe
+enum class QREvent{
+    Entered,    // inserted or moved into the window
+    Left        // expired, deleted or moved out of the window
+};
+
+// what each cell of a raster counts, see QRBasicTree::Rasterize
+enum class QRRaster{
+    Count,      // the payloads whose box centre lies in the cell, a density
+    Cover       // the payloads whose box overlaps the cell
+};
+
+// Hilbert curve index of a cell, x holds dim coordinates of bits bits each and is overwritten
+std::uint64_t QRHilbertIndex(std::uint32_t *x, int dim, int bits);
+
+// R*-tree over Dim dimensions, Scalar coordinates and Payload leaves, see QRPayloadTraits
+// for what a payload has to provide. QRTree below is the 2-D double tree of Circles.
+template<int Dim, typename Scalar, typename Payload>
+struct QRBasicTree{
+    // saves and thaws a 2-D double tree node by node
+    friend class QRPackedTree;
+    // moves leaves between shards with their stamps
+    friend class QRShardedTree;
+
+public:
+    typedef QRBasicBox<Dim, Scalar> Box;
+    typedef QRBasicBall<Dim, Scalar> Ball;
+    typedef QRBasicInnernode<Dim, Scalar> Innernode;
+    typedef QRBasicLeafnode<Dim, Scalar, Payload> Leafnode;
+    typedef QRPayloadTraits<Dim, Scalar, Payload> Traits;
+    typedef QRBasicSummary<Scalar> Summary;
+    typedef std::array<Scalar, Dim> Point;
+    typedef QRBasicPolygon<Scalar> Polygon;
+    typedef QRBasicSegment<Scalar> Segment;
+
+    // Query windows. enter() tells whether a subtree may hold a hit, accept() whether
+    // a leaf is one. Box overlap filters, the payload tests refine.
+    struct BoxWindow{
+        Box bb;
+        bool exact;
+
+        bool enter(const Box &node) const{return node.overlaps(bb);}
+        bool accept(const Leafnode &leaf) const{
+            return leaf.overlaps(bb) && (!exact || Traits::overlaps(leaf.cir, bb));
+        }
+    };
+
+    struct BallWindow{
+        Ball ball;
+
+        bool enter(const Box &node) const{return BallOverlapsBox(ball, node);}
+        bool accept(const Leafnode &leaf) const{return Traits::overlaps(leaf.cir, ball);}
+    };
+
+    // a box and the stamps from tmin to tmax, both in. With QRTREE_STAMPS a subtree whose
+    // stamps all lie outside is not entered, whatever its box
+    struct StampWindow{
+        BoxWindow box;
+        std::uint64_t tmin;
+        std::uint64_t tmax;
+
+        bool enter(const Innernode &node) const{
+#if QRTREE_STAMPS
+            if(node.stamp_max < tmin || node.stamp_min > tmax)
+                return false;
+#endif
+            return box.enter(node);
+        }
+        bool accept(const Leafnode &leaf) const{
+            return leaf.stamp >= tmin && leaf.stamp <= tmax && box.accept(leaf);
+        }
+    };
+
+    // the 2-D shapes. Node boxes are tested exactly against a polygon, and against a
+    // segment by clipping it to the node grown by its half width, which only errs at the
+    // rounded corners. Leaves are tested exactly by Traits
+    struct PolygonWindow{
+        const Polygon *polygon;
+
+        bool enter(const Box &node) const{return polygon->overlaps(node);}
+        bool accept(const Leafnode &leaf) const{return leaf.overlaps(polygon->bound) && Traits::overlaps(leaf.cir, *polygon);}
+    };
+
+    struct SegmentWindow{
+        Segment segment;
+        Box reach;
+
+        explicit SegmentWindow(const Segment &s): segment(s), reach(s.bounds()){}
+        bool enter(const Box &node) const{
+            if(!node.overlaps(reach))
+                return false;
+            Box grown = node;
+            for(int i = 0; i < 2; ++i){
+                grown.range[i].first -= segment.r;
+                grown.range[i].second += segment.r;
+            }
+            return SegmentMeetsBox(segment.x0, segment.y0, segment.x1, segment.y1, grown);
+        }
+        bool accept(const Leafnode &leaf) const{return leaf.overlaps(reach) && Traits::overlaps(leaf.cir, segment);}
+    };
+
+    // Lazy window query. Walks the tree with a fixed-size stack of its own, so iterating
+    // allocates nothing. The tree must not be modified while an iterator is in use.
+    class QueryIterator{
+    private:
+        struct Frame{
+            const Innernode *node;
+            std::size_t index;
+        };
+
+        BoxWindow window;
+        Frame stack[QRTREE_MAX_HEIGHT];
+        int top;
+        const Leafnode *cur;
+
+        void advance();
+
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef Payload value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const Payload* pointer;
+        typedef const Payload& reference;
+
+        // end iterator
+        QueryIterator(): top(-1), cur(nullptr){}
+        QueryIterator(const Innernode *root, const Box &bb, QRRefine refine = QRRefine::Box);
+
+        reference operator*() const{return cur->cir;}
+        pointer operator->() const{return &cur->cir;}
+        const Leafnode* leaf() const{return cur;}
+
+        QueryIterator& operator++(){advance(); return *this;}
+        QueryIterator operator++(int){QueryIterator tmp = *this; advance(); return tmp;}
+
+        bool operator==(const QueryIterator &it) const{return cur == it.cur;}
+        bool operator!=(const QueryIterator &it) const{return cur != it.cur;}
+    };
+
+    struct QueryRange{
+        QueryIterator first;
+        QueryIterator begin() const{return first;}
+        QueryIterator end() const{return QueryIterator();}
+    };
+
+    // result of a distance query, dist is measured as Traits::distance does
+    struct Neighbour{
+        Payload cir;
+        Scalar dist;
+    };
+    // The inner nodes a distance query has still to expand. Pass the same one to every
+    // call, it keeps its capacity.
+    struct NearestQueue{
+        struct Entry{
+            // squared, to the box of node
+            Scalar dist;
+            const Innernode *node;
+        };
+        std::vector<Entry> entries;
+    };
+
+    // Refers to one payload for as long as it stays in the tree, through splits, reinserts,
+    // updates and Compact. With slab pools Valid() tells whether it still does, with slab 0
+    // it must not be used once the payload expired or was deleted. Read the payload through
+    // Get(), after a Compact leaf may point to where it was.
+    struct Handle{
+        Leafnode *leaf;
+        std::uint64_t id;
+        // leaf may be read until more Compact runs than this have ended, after that the
+        // payload is found by id among the leaves Compact moved
+        std::uint64_t moves;
+    };
+
+    // Results of QueryBatch, the hits of window i are hits[offset[i]] .. hits[offset[i + 1] - 1].
+    // Pass the same one to every batch, its buffers keep their capacity.
+    struct BatchResult{
+        std::vector<Payload> hits;
+        std::vector<std::size_t> offset;
+
+        std::size_t size() const{return offset.empty() ? 0 : offset.size() - 1;}
+        const Payload* begin(std::size_t i) const{return hits.data() + offset[i];}
+        const Payload* end(std::size_t i) const{return hits.data() + offset[i + 1];}
+
+        // what each thread found, before it is gathered into hits
+        struct Scratch{
+            std::vector<Payload> hits;
+            std::vector<std::pair<std::uint32_t, const Leafnode*>> grouped;
+        };
+        std::vector<Scratch> scratch;
+        // per window, the thread that ran it and where its hits start in that thread's scratch
+        std::vector<std::uint32_t> thread;
+        std::vector<std::size_t> first;
+        // curve key and index of the windows in the order they are run
+        std::vector<std::pair<std::uint64_t, std::uint32_t>> order;
+    };
+
+    // Counters since construction or ResetStats(). The first four are the writer's, the
+    // others are added to by every query but those of a QueryIterator
+    struct Counters{
+        std::uint64_t splits = 0;
+        std::uint64_t reinserts = 0;        // leaves moved by forced reinsertion
+        std::uint64_t condensed = 0;        // leaves, or subtrees, reinserted after their node was eliminated
+        std::uint64_t root_changes = 0;     // the root split or collapsed
+        std::uint64_t queries = 0;
+        std::uint64_t visited = 0;          // inner nodes entered
+        std::uint64_t tested = 0;           // leaves tested against a window
+        std::uint64_t returned = 0;
+        // CachedQuery, the hit rate is cache_hits / (cache_hits + cache_misses)
+        std::uint64_t cache_hits = 0;
+        std::uint64_t cache_misses = 0;
+    };
+
+    // Shape of the tree, per level from the root down to the leaf-parents. overlap is the
+    // area shared by pairs of children of a node on the level, dead the area of its nodes
+    // that no child covers, taken as node area - child areas + their overlap and so exact
+    // where children overlap at most in pairs
+    struct Statistics{
+        int height = 0;
+        std::size_t size = 0;
+        std::vector<std::size_t> nodes;
+        // fill[l][k] nodes of level l with k children
+        std::vector<std::vector<std::size_t>> fill;
+        std::vector<Scalar> overlap;
+        std::vector<Scalar> dead;
+        Scalar total_overlap = 0;
+        Scalar total_dead = 0;
+        Counters counters;
+    };
 
-struct QRTree{
 private:
-    int dim;
+    // what one query walked, counted into _walked once it is done
+    struct Walk{
+        std::size_t visited = 0;
+        std::size_t tested = 0;
+        std::size_t returned = 0;
+    };
+    // a line of its own, so that readers on other threads do not write to it
+    struct alignas(64) WalkCounters{
+        std::atomic<std::uint64_t> queries{0};
+        std::atomic<std::uint64_t> visited{0};
+        std::atomic<std::uint64_t> tested{0};
+        std::atomic<std::uint64_t> returned{0};
+    };
+    // the writer's counters, the query fields are kept in _walked and summed on reading
+    Counters _counters;
+    mutable WalkCounters _walked[QRTREE_STATS_STRIPES];
+    // the stripe of the calling thread, handed out in turn as threads first count
+    static std::size_t Stripe(){
+        static std::atomic<std::size_t> next{0};
+        thread_local const std::size_t stripe = next.fetch_add(1, std::memory_order_relaxed) % QRTREE_STATS_STRIPES;
+        return stripe;
+    }
+    void Count(const Walk &walk, std::size_t queries = 1) const{
+#if QRTREE_STATS
+        WalkCounters &walked = _walked[Stripe()];
+        walked.queries.fetch_add(queries, std::memory_order_relaxed);
+        walked.visited.fetch_add(walk.visited, std::memory_order_relaxed);
+        walked.tested.fetch_add(walk.tested, std::memory_order_relaxed);
+        walked.returned.fetch_add(walk.returned, std::memory_order_relaxed);
+#endif
+    }
+
     int min_child;
     int max_child;
+    QRSplit _split;
+    QRChoose _choose;
     std::size_t _size;
     Innernode *_root;
     // typedef Leafnode* value_type;
@@ -44,25 +355,247 @@ private:
     Leafnode *end;
     std::size_t _size_full;
 
+    // FIFO expiry, see Set_expiry. _stamp is the stamp of the newest leaf, with a ttl no
+    // batch is due before _expire_at
+    std::uint64_t _stamp;
+    std::uint64_t _ttl;
+    std::size_t _expire_batch;
+    std::uint64_t _expire_at;
+
+    // ids of the leaves, for handles, and Compact runs ended, each freeing the old slabs
+    std::uint64_t _ids;
+    std::uint64_t _moves;
+    // the leaves Compact moved by id, each until it is freed, so that older handles find them
+    std::unordered_map<std::uint64_t, Leafnode*> _moved;
+    // the leaf of h, nullptr if its payload is gone. Reads h.leaf only while its slab is kept
+    Leafnode* Resolve(const Handle &h) const{
+        if(!h.leaf)
+            return nullptr;
+        if(h.moves >= _moves && h.leaf->id == h.id)
+            return h.leaf;
+        if(_moved.empty())
+            return nullptr;
+        const auto at = _moved.find(h.id);
+        return at == _moved.end() ? nullptr : at->second;
+    }
+    // a leaf in the new slabs of a Compact under way outlives its end
+    std::uint64_t MovesOf(const Leafnode *leaf) const{
+        return _moves + (_compacting && _leafpool.owns(leaf) ? 1 : 0);
+    }
+    void Forget(Leafnode *leaf){
+        if(leaf->id && !_moved.empty())
+            _moved.erase(leaf->id);
+        leaf->id = 0;
+    }
+    // the payload of leaf replaced by tar, FIFO place and identity kept. A new leaf if
+    // readers may still see this one, the caller then relinks its parent
+    Leafnode* Rewrite(Leafnode *leaf, Payload &&tar);
+    // leaves from front older than ttl at now, counted up to limit
+    std::size_t Due(std::uint64_t now, std::size_t limit) const;
+    void ExpireFront(std::size_t k);
+
+    // node storage, every Leafnode and Innernode of this tree comes from here
+    QRPool<Leafnode> _leafpool;
+    QRPool<Innernode> _innerpool;
+
+    Leafnode* NewLeaf(Payload &&tar);
+    Innernode* NewInner(bool leafchild);
+    // with concurrent readers a node they may still see is retired instead, and
+    // recycled once no reader can hold it any more
+    void FreeLeaf(Leafnode *leaf){
+        Forget(leaf);
+        if(_concurrent)
+            _retired_leaf.emplace_back(_epoch.Current(), leaf);
+        else
+            RecycleLeaf(leaf);
+    }
+    void FreeInner(Innernode *inode){
+        if(_concurrent && inode->version != _version)
+            _retired_inner.emplace_back(_epoch.Current(), inode);
+        else
+            RecycleInner(inode);
+    }
+    // a node Compact has not moved yet stays in the old slabs, which go at once
+    void RecycleInner(Innernode *inode){
+        if(_compacting && !_innerpool.owns(inode))
+            --_compact_left;
+        else
+            _innerpool.put(inode);
+    }
+    void RecycleLeaf(Leafnode *leaf){
+        // pooled leaves stay constructed, let go of what the payload holds
+        if(!std::is_trivially_destructible<Payload>::value)
+            leaf->cir = Payload();
+        Forget(leaf);
+        if(_compacting && !_leafpool.owns(leaf))
+            --_compact_left;
+        else
+            _leafpool.put(leaf);
+    }
+
+    // Compact under way: new nodes come from the pools above, the old ones still hold
+    // _compact_left live nodes. The path gives the child index on each level down to the
+    // next node to move, it is followed from the root again at every step
+    bool _compacting;
+    std::size_t _compact_left;
+    std::vector<std::size_t> _compact_path;
+    QRPool<Leafnode> _old_leafpool;
+    QRPool<Innernode> _old_innerpool;
+    // copies into the new pools, linked in place of the old node
+    Innernode* MoveInner(Innernode *inode);
+    void MoveLeaf(Innernode *parent, std::size_t i);
+
+    // Copy-on-write for concurrent readers. Readers only look at the boxes, child lists and
+    // leafchild flags of inner nodes and the boxes and payloads of leaves, and every
+    // write to those goes to a node of the current version. Own() copies an older node
+    // into the current version together with its path up to the root; the parent, prev
+    // and next links are the writer's own and are changed in place. Publish() makes the
+    // current version the one new readers see.
+    bool _concurrent;
+    std::uint64_t _version;
+    std::atomic<const Innernode*> _published;
+    mutable QREpoch _epoch;
+    std::deque<std::pair<std::uint64_t, Innernode*>> _retired_inner;
+    std::deque<std::pair<std::uint64_t, Leafnode*>> _retired_leaf;
+
+    // In place without readers, then only the version of inode and its path is stamped
+    Innernode* Own(Innernode *inode);
+    void Publish();
+
+    // A window of CachedQuery. frontier holds every inner node the query entered, sorted,
+    // with the number of leaf-parents it entered below it. Writes stamp the nodes they
+    // change and their path up to the root, so a node with a version below the entry's is
+    // as the query saw it
+    struct CacheKey{
+        Box window;
+        bool exact;
+
+        bool operator==(const CacheKey &k) const{
+            for(int i = 0; i < Dim; ++i)
+                if(window.range[i] != k.window.range[i])
+                    return false;
+            return exact == k.exact;
+        }
+    };
+    struct CacheHash{
+        std::size_t operator()(const CacheKey &k) const{
+            std::size_t h = k.exact;
+            for(int i = 0; i < Dim; ++i){
+                h = h * 31 + std::hash<Scalar>()(k.window.range[i].first);
+                h = h * 31 + std::hash<Scalar>()(k.window.range[i].second);
+            }
+            return h;
+        }
+    };
+    struct CacheEntry{
+        CacheKey key;
+        std::uint64_t version;
+        std::size_t leafparents;
+        std::size_t bytes;
+        std::vector<Payload> result;
+        std::vector<std::pair<const Innernode*, std::size_t>> frontier;
+    };
+    // most recently used first
+    std::list<CacheEntry> _cache;
+    std::unordered_map<CacheKey, typename std::list<CacheEntry>::iterator, CacheHash> _cache_index;
+    std::size_t _cache_bytes;
+    std::size_t _cache_limit;
+    void FillCache(CacheEntry &entry);
+    // the leaf-parents entered below inode
+    std::size_t InnerFillCache(const Innernode *inode, const BoxWindow &window, CacheEntry &entry, Walk &walk) const;
+    // whether the nodes the window meets below inode are as entry saw them, adding the
+    // leaf-parents found unchanged to matched
+    bool CacheHolds(const Innernode *inode, const CacheEntry &entry, std::size_t &matched) const;
+    void EvictCache();
+
+    // Standing queries, scanned one by one after a test against the union of their
+    // windows: a client holds a few viewports, not thousands
+    struct Subscription{
+        std::size_t id;
+        BoxWindow window;
+        std::function<void(const Payload&, QREvent)> callback;
+    };
+    std::vector<Subscription> _subs;
+    Box _subs_bound;
+    std::size_t _sub_ids;
+    // tells the standing queries that leaf entered or is about to leave the tree. Only
+    // where payloads come and go, splits, reinserts and Compact move leaves silently
+    void Notify(const Leafnode &leaf, QREvent event) const{
+        if(_subs.empty() || !leaf.overlaps(_subs_bound))
+            return;
+        for(auto &sub: _subs)
+            if(sub.window.accept(leaf))
+                sub.callback(leaf.cir, event);
+    }
+
+    // the summary and stamp range of inode from those of its children, or with what a leaf
+    // or subtree hung below it adds. Nothing without QRTREE_AGGREGATE and QRTREE_STAMPS
+    static void Summarise(Innernode *inode);
+    static void Summarise(Innernode *inode, const Leafnode *leaf);
+    static void Summarise(Innernode *inode, const Innernode *subtree);
+    // Aggregate below root, counted into the stats
+    Summary Aggregate(const Innernode *root, const BoxWindow &window) const;
+    void Reclaim(std::uint64_t before);
+
+    // scratch buffers of Reinsert and CondenseTree, kept so that their capacity is reused
+    std::vector<Box*> _reinsert_buf;
+    std::vector<Innernode*> _condense_buf;
+    std::vector<Leafnode*> _orphan_buf;
+    std::vector<Innernode*> _level_buf;
+    std::vector<Innernode*> _expire_buf;
+    mutable QRBasicChildBoxes<Dim, Scalar> _choose_buf;
+    std::vector<Box> _sweep_buf;
+    std::vector<Box*> _split_buf;
+
+    // Each orders the children of an overflowing node so that those before the index
+    // returned stay and the rest go to the new node
+    std::size_t SplitRStar(std::vector<Box*> &child);
+    std::size_t SplitQuadratic(std::vector<Box*> &child);
+    std::size_t SplitLinear(std::vector<Box*> &child);
+    // Guttman's distribution from the seeds s1 and s2, the others in turn or, with
+    // pickNext, the one that prefers a group most first
+    std::size_t Distribute(std::vector<Box*> &child, std::size_t s1, std::size_t s2, bool pickNext);
+
+    // STR order of items on axis and the ones after it, for k parents
+    void TileLevel(typename std::vector<Box*>::iterator first, typename std::vector<Box*>::iterator last,
+        int axis, std::size_t k);
+
 public:
     // for insertion
-    Innernode* ChooseSubTree(Innernode *inode, const QRBoundingBox *bb) const;
+    Innernode* ChooseSubTree(Innernode *inode, const Box *bb) const;
+    // QRChoose::Revised, on the child boxes ChooseSubTree gathered
+    Innernode* ChooseRevised(Innernode *inode, const Box *bb, const Scalar *enlargement) const;
     Innernode* Insert(Leafnode *leaf, Innernode *inode, bool firstInLevel = true);
-    // to insert a subtree 
+    // to insert a subtree, hung so that its leaves are at the depth of the others. Overflows
+    // are split, the tree must be higher than the subtree
     Innernode* Insert(Innernode* toInsert, Innernode *inode, bool firstInLevel = true);
     Innernode* OverflowTreatment(Innernode *level, bool firstInLevel);
     Innernode* Split(Innernode *inode);
     void Reinsert(Innernode *inode);
 
     // for query
-    void  Innerquery(Innernode* inode, const QRBoundingBox &bb, std::vector<Leafnode> *result);
+    void  Innerquery(Innernode* inode, const Box &bb, std::vector<Leafnode> *result, QRRefine refine = QRRefine::Box);
 
     // for deletion
     // find a single leaf node, not massive leaves ovelapping a specific region
-    void FindLeaf(Innernode* inode, const QRNode &tar, std::vector<Leafnode*> &toDelete);
+    void FindLeaf(Innernode* inode, const Box &tar, std::vector<Leafnode*> &toDelete, QRRefine refine = QRRefine::Box);
 
     // UnderflowTreatment, only for single node removal, not for massive operations
     void CondenseTree(Leafnode *del);
+    // the same for many leaf-parents at once, each node is condensed once
+    void CondenseLevels(std::vector<Innernode*> &level);
+    // tightens N and takes it out of its parent if it underflows, see CondenseLevels
+    void CondenseNode(Innernode *N);
+    // CT6 and the root, reinserts what the condense pass put in _condense_buf. The leaves
+    // one by one, or with subtrees set the children of eliminated inner nodes whole
+    void ReinsertCondensed(bool subtrees = false);
+    // Delete below inode, appends the nodes that lost entries below them to changed,
+    // children before their parent. true if inode did
+    bool InnerDelete(Innernode *inode, const BoxWindow &window, std::vector<Innernode*> &changed);
+    // frees a subtree that was taken out of the tree, with its leaves
+    void DropSubtree(Innernode *inode);
+    // takes a leaf out of the FIFO list and the count
+    void Unlink(Leafnode *leaf);
 
     // 因为外部输入的矩形框内点删除的算法会破坏队列的结构，因此禁止矩形删除，只保留点删除功能，而且只能删除front点
     // reinsert功能呢？？因为点的寿命从它最初被插入到树开始算，树调整过程中，点一直存在，对外未表现出插入与删除的
@@ -70,19 +603,680 @@ public:
     void DeleteLeaf(Leafnode *leaf);
     void Destroy(Innernode* inode);
 
-    QRTree(std::size_t s,int dim = 2, int min_child = 10, int max_child = 20):
-       _size_full(s), dim(dim), min_child(min_child), max_child(max_child), _size(0), _root(nullptr){}
-    ~QRTree(){Destroy(_root);}
+    // bottom-up packing of a batch of leaves into the empty tree, stamped from stamps, one
+    // in order for each payload, or counted up
+    void BulkLoad(std::vector<Payload> &&data, QRPacking packing, const std::uint64_t *stamps = nullptr);
+    std::vector<Box*> PackLevel(std::vector<Box*> &items, bool leafchild, QRPacking packing);
+    // Hilbert index of the centre of b within bound
+    static std::uint64_t CurveKey(const Box &bound, const Box &b);
+
+    // best-first search below root from a point of Dim coordinates, appends up to k
+    // results no farther than maxdist, nearest first
+    void BestFirst(const Innernode *root, const Scalar *point, std::size_t k, Scalar maxdist,
+        std::vector<Neighbour> &out, NearestQueue &queue) const;
+    // the same keyed by where the ray enters each box, for the first payload it meets
+    bool RayFirst(const Innernode *root, const Scalar *origin, const Scalar *dir, Scalar maxdist, Neighbour &hit) const;
+
+    // visitor query, visit(const Leafnode&) for every leaf the window accepts, false
+    // once visit asked to stop. What it walked is added to walk
+    template<typename W, typename F>
+    bool InnerVisit(const Innernode *inode, const W &window, F &visit, Walk &walk) const;
+    // the same for a whole query, counted into the stats
+    template<typename W, typename F>
+    void Visit(const Innernode *root, const W &window, F &visit) const{
+        Walk walk;
+        if(root)
+            InnerVisit(root, window, visit, walk);
+        Count(walk);
+    }
+    // one walk for up to 64 windows, mask holds those that overlap inode and bound is the
+    // union of all of them, appends (window, leaf) for every hit
+    void InnerGroup(const Innernode *inode, const Box &bound, const BoxWindow *windows, std::uint64_t mask,
+        std::vector<std::pair<std::uint32_t, const Leafnode*>> &out, Walk &walk) const;
+    // adds to sum what the window accepts below inode, the whole summary of inode if it
+    // lies inside the window
+    void InnerAggregate(const Innernode *inode, const BoxWindow &window, Summary &sum, Walk &walk) const;
+
+    // A grid of size[0] x size[1] cells over the first two axes of bb, each half open but
+    // for those on its upper edges. Only the rows from row0 up to row1 are written
+    struct RasterGrid{
+        Box bb;
+        // cells per unit along each axis
+        Scalar scale[2];
+        std::size_t size[2];
+        std::size_t row0;
+        std::size_t row1;
+        QRRaster mode;
+
+        // the cell along axis i that v falls into, those beyond the edges clamped to them
+        std::size_t cellOf(int i, Scalar v) const{
+            const Scalar f = (v - bb.range[i].first) * scale[i];
+            if(!(f > 0))
+                return 0;
+            return f >= Scalar(size[i]) ? size[i] - 1 : std::size_t(f);
+        }
+    };
+    RasterGrid MakeGrid(const Box &bb, std::size_t width, std::size_t height, QRRaster mode) const;
+    // adds what lies below inode to the rows of the grid, row-major in out. A subtree inside
+    // bb that falls into one cell is added from its summary, below one inside bb at all the
+    // leaves are not tested against it
+    void InnerRaster(const Innernode *inode, const RasterGrid &grid, bool inside, std::uint32_t *out, Walk &walk) const;
+    // the same from root, counted into the stats as queries queries
+    void Raster(const Innernode *root, const RasterGrid &grid, std::uint32_t *out, std::size_t queries) const;
+
+    // for joins. Buffers of one join, two for each level of the recursion
+    typedef std::vector<std::vector<const Box*>> JoinScratch;
+    // a pair of nodes still to be joined, or a node to be joined with itself if b is null
+    struct JoinTask{
+        const Innernode *a;
+        const Innernode *b;
+    };
+    // pair(x, y) for every overlapping pair of the entries of a and b, those outside the
+    // overlap of a and b are left out first, the rest swept along the first axis
+    template<typename G>
+    static bool SweepPairs(const Innernode *a, const Innernode *b, std::vector<const Box*> &fa,
+        std::vector<const Box*> &fb, G &&pair);
+    // the same for the pairs within one node, each once
+    template<typename G>
+    static bool SweepSelf(const Innernode *a, std::vector<const Box*> &fa, G &&pair);
+    // emit(const Leafnode&, const Leafnode&) for the overlapping leaves below a and b,
+    // false once emit asked to stop
+    template<typename E>
+    static bool JoinNodes(const Innernode *a, const Innernode *b, E &emit, JoinScratch &scratch, int depth);
+    template<typename E>
+    static bool JoinSelf(const Innernode *a, E &emit, JoinScratch &scratch, int depth);
+    // splits the tasks into those of the levels below until there are at least n of them
+    static void SplitJoin(std::vector<JoinTask> &tasks, std::size_t n);
+    template<typename E>
+    static void JoinParallel(std::vector<JoinTask> &&tasks, E &&emit, QRThreadPool &pool);
+
+    // slab is the number of nodes allocated at once by the node pools, 0 for plain new/delete.
+    // dim is there for the old signature and must be Dim
+    QRBasicTree(std::size_t s, int dim = Dim, int min_child = 10, int max_child = 20, std::size_t slab = QRTREE_POOL_SLAB):
+       min_child(min_child), max_child(max_child), _split(QRSplit::RStar), _choose(QRChoose::RStar), _size(0),
+       _root(nullptr), front(nullptr), end(nullptr), _size_full(s), _stamp(0), _ttl(0), _expire_batch(1),
+       _expire_at(0), _ids(0), _moves(0), _leafpool(slab), _innerpool(slab), _compacting(false), _compact_left(0), _old_leafpool(slab), _old_innerpool(slab),
+       _concurrent(false), _version(0), _published(nullptr), _cache_bytes(0), _cache_limit(0), _sub_ids(0){assert(dim == Dim);}
+    // build from a batch at once, nodes are filled up to max_child. The FIFO order is the
+    // order of data, if there are more than s payloads only the last s are kept
+    QRBasicTree(std::vector<Payload> &&data, std::size_t s, QRPacking packing = QRPacking::STR,
+        int dim = Dim, int min_child = 10, int max_child = 20, std::size_t slab = QRTREE_POOL_SLAB):
+        QRBasicTree(s, dim, min_child, max_child, slab){BulkLoad(std::move(data), packing);}
+    QRBasicTree(const QRBasicTree&) = delete;
+    QRBasicTree& operator=(const QRBasicTree&) = delete;
+    ~QRBasicTree(){Destroy(_root);}
+
+    // refine selects whether payloads are matched by their bounding box or exactly
+    std::vector<Leafnode>* Query(const Box &bb, QRRefine refine = QRRefine::Box);
+
+    // the forms below copy no Leafnode and allocate nothing per call
+    // visit(const Payload&) is called for each hit, returning false stops the query
+    template<typename F>
+    void Query(const Box &bb, F &&visit, QRRefine refine = QRRefine::Box) const;
+    // appends the hits to out, which the caller may clear and reuse
+    void Query(const Box &bb, std::vector<Payload> &out, QRRefine refine = QRRefine::Box) const;
+    // only the payloads stamped from tmin to tmax, say Get_stamp() - n + 1 up for the last n
+    // inserted without stamps
+    template<typename F>
+    void Query(const Box &bb, std::uint64_t tmin, std::uint64_t tmax, F &&visit, QRRefine refine = QRRefine::Box) const;
+    void Query(const Box &bb, std::uint64_t tmin, std::uint64_t tmax, std::vector<Payload> &out,
+        QRRefine refine = QRRefine::Box) const{
+        Query(bb, tmin, tmax, [&out](const Payload &hit){
+            out.push_back(hit);
+            return true;
+        }, refine);
+    }
+    // Keeps the results of CachedQuery by window in up to bytes of memory, the least
+    // recently used go first. 0 turns it off
+    void Set_query_cache(std::size_t bytes);
+    // Query through the cache. A result is reused while no node the query entered, nor
+    // any node the window meets, was written since; else it is queried again
+    void CachedQuery(const Box &bb, std::vector<Payload> &out, QRRefine refine = QRRefine::Box);
+    // Standing query: callback(payload, event) as payloads enter or leave the window,
+    // first Entered for those in it already. Inserts, expiry, deletes and Update report,
+    // a payload moved within the window Left with its old value and Entered with the new.
+    // The callback must not write to the tree. Returns the id for Unsubscribe
+    std::size_t Subscribe(const Box &bb, std::function<void(const Payload&, QREvent)> callback,
+        QRRefine refine = QRRefine::Box);
+    bool Unsubscribe(std::size_t id);
+    // lazy, for(const Circle &cir: tree.Iterate(bb))
+    QueryRange Iterate(const Box &bb, QRRefine refine = QRRefine::Box) const{
+        return QueryRange{QueryIterator(_root, bb, refine)};
+    }
+
+    // Runs every window on the pool, the tree must not change meanwhile. Nothing is
+    // allocated per window once result has grown to the batch. With group set, the windows
+    // are run in Hilbert order of their centres and up to 64 neighbours share one walk.
+    void QueryBatch(const std::vector<Box> &windows, BatchResult &result, QRThreadPool &pool,
+        bool group = false, QRRefine refine = QRRefine::Box) const;
+    BatchResult QueryBatch(const std::vector<Box> &windows, QRThreadPool &pool, bool group = false,
+        QRRefine refine = QRRefine::Box) const{
+        BatchResult result;
+        QueryBatch(windows, result, pool, group, refine);
+        return result;
+    }
+
+    // payloads that overlap the ball exactly
+    template<typename F>
+    void QueryBall(const Ball &ball, F &&visit) const;
+    void QueryBall(const Ball &ball, std::vector<Payload> &out) const;
+    // the same for a 2-D tree, circles whose disc overlaps the disc of cir
+    template<typename F>
+    void QueryCircle(const Circle &cir, F &&visit) const{
+        static_assert(Dim == 2, "QueryCircle needs a 2-D tree, use QueryBall");
+        QueryBall(Ball{{Scalar(cir.x), Scalar(cir.y)}, Scalar(cir.r)}, std::forward<F>(visit));
+    }
+    void QueryCircle(const Circle &cir, std::vector<Payload> &out) const{
+        QueryCircle(cir, [&out](const Payload &hit){
+            out.push_back(hit);
+            return true;
+        });
+    }
+
+    // payloads that overlap the polygon exactly, for a 2-D tree
+    template<typename F>
+    void QueryPolygon(const Polygon &polygon, F &&visit) const;
+    void QueryPolygon(const Polygon &polygon, std::vector<Payload> &out) const{
+        QueryPolygon(polygon, [&out](const Payload &hit){
+            out.push_back(hit);
+            return true;
+        });
+    }
+    // payloads within width / 2 of the segment from (x0, y0) to (x1, y1), for a 2-D tree
+    template<typename F>
+    void QuerySegment(Scalar x0, Scalar y0, Scalar x1, Scalar y1, Scalar width, F &&visit) const;
+    void QuerySegment(Scalar x0, Scalar y0, Scalar x1, Scalar y1, Scalar width, std::vector<Payload> &out) const{
+        QuerySegment(x0, y0, x1, y1, width, [&out](const Payload &hit){
+            out.push_back(hit);
+            return true;
+        });
+    }
+    // The first payload the ray from origin along dir meets within maxdist, hit.dist being
+    // how far along. Nodes are walked in the order the ray enters them, so the walk ends at
+    // the first node entered beyond the nearest hit. false if it meets nothing
+    bool Raycast(const Point &origin, const Point &dir, Neighbour &hit,
+        Scalar maxdist = std::numeric_limits<Scalar>::infinity()) const{
+        return RayFirst(_root, origin.data(), dir.data(), maxdist, hit);
+    }
+    bool Raycast(Scalar x, Scalar y, Scalar dx, Scalar dy, Neighbour &hit,
+        Scalar maxdist = std::numeric_limits<Scalar>::infinity()) const{
+        static_assert(Dim == 2, "Raycast(x, y, dx, dy) needs a 2-D tree");
+        return Raycast(Point{{x, y}}, Point{{dx, dy}}, hit, maxdist);
+    }
+
+    // What the payloads the window accepts add up to, see QRBasicSummary. A subtree whose
+    // box lies inside bb is taken from its summary, so the cost is that of the nodes on the
+    // edge of bb rather than of the hits. Without QRTREE_AGGREGATE every hit is visited
+    Summary Aggregate(const Box &bb, QRRefine refine = QRRefine::Box) const{
+        return Aggregate(_root, BoxWindow{bb, refine == QRRefine::Exact});
+    }
+    std::size_t Count(const Box &bb, QRRefine refine = QRRefine::Box) const{return Aggregate(bb, refine).count;}
+
+    // Counts the payloads over a width x height grid on the first two axes of bb into out,
+    // row-major from the lower corner, in one walk. A subtree inside bb that falls into a
+    // single cell is taken from its summary, so a coarse raster costs about the nodes rather
+    // than the payloads. Box refined, beyond 2-D the other axes of bb only filter
+    void Rasterize(const Box &bb, std::size_t width, std::size_t height, std::vector<std::uint32_t> &out,
+        QRRaster mode = QRRaster::Count) const{
+        out.assign(width * height, 0);
+        Raster(_root, MakeGrid(bb, width, height, mode), out.data(), 1);
+    }
+    // the same in bands of rows across the pool, each band a walk of its own
+    void Rasterize(const Box &bb, std::size_t width, std::size_t height, std::vector<std::uint32_t> &out,
+        QRThreadPool &pool, QRRaster mode = QRRaster::Count) const;
+
+    // distance queries by Traits::distance, results sorted nearest first
+    std::vector<Neighbour> Nearest(const Point &p, std::size_t k) const;
+    std::vector<Neighbour> WithinDistance(const Point &p, Scalar d) const;
+    // append to out, which the caller may clear and reuse, and allocate nothing per call
+    // once out and queue have grown
+    void Nearest(const Point &p, std::size_t k, std::vector<Neighbour> &out, NearestQueue &queue) const{
+        BestFirst(_root, p.data(), k, std::numeric_limits<Scalar>::infinity(), out, queue);
+    }
+    void WithinDistance(const Point &p, Scalar d, std::vector<Neighbour> &out, NearestQueue &queue) const{
+        BestFirst(_root, p.data(), std::numeric_limits<std::size_t>::max(), d, out, queue);
+    }
+    // the same for a 2-D tree
+    std::vector<Neighbour> Nearest(Scalar x, Scalar y, std::size_t k) const{
+        static_assert(Dim == 2, "Nearest(x, y, k) needs a 2-D tree");
+        return Nearest(Point{{x, y}}, k);
+    }
+    std::vector<Neighbour> WithinDistance(Scalar x, Scalar y, Scalar d) const{
+        static_assert(Dim == 2, "WithinDistance(x, y, d) needs a 2-D tree");
+        return WithinDistance(Point{{x, y}}, d);
+    }
+    void Nearest(Scalar x, Scalar y, std::size_t k, std::vector<Neighbour> &out, NearestQueue &queue) const{
+        static_assert(Dim == 2, "Nearest(x, y, k) needs a 2-D tree");
+        Nearest(Point{{x, y}}, k, out, queue);
+    }
+    void WithinDistance(Scalar x, Scalar y, Scalar d, std::vector<Neighbour> &out, NearestQueue &queue) const{
+        static_assert(Dim == 2, "WithinDistance(x, y, d) needs a 2-D tree");
+        WithinDistance(Point{{x, y}}, d, out, queue);
+    }
+
+    // Spatial join with other, in step down both trees. onPair(const Payload &mine, const Payload &its)
+    // for every pair that overlaps as refine says, returning false stops the join
+    template<typename F>
+    void Join(const QRBasicTree &other, F &&onPair, QRRefine refine = QRRefine::Exact) const;
+    // the pairs within this tree, each once and no payload with itself
+    template<typename F>
+    void SelfJoin(F &&onPair, QRRefine refine = QRRefine::Exact) const;
+    // the same on the pool, the pairs of nodes near the roots are shared out among the
+    // threads. onPair(a, b, thread) is called from all of them and cannot stop the join
+    template<typename F>
+    void Join(const QRBasicTree &other, F &&onPair, QRThreadPool &pool, QRRefine refine = QRRefine::Exact) const;
+    template<typename F>
+    void SelfJoin(F &&onPair, QRThreadPool &pool, QRRefine refine = QRRefine::Exact) const;
+
+    // A consistent read-only view of the tree for another thread, taken without a lock
+    // while the writer goes on. It pins the version it saw until it is destroyed, so
+    // keep it short. Needs Set_concurrent(true).
+    class Snapshot{
+    private:
+        const QRBasicTree *tree;
+        const Innernode *root;
+        int slot;
+
+    public:
+        explicit Snapshot(const QRBasicTree &t): tree(&t), slot(t._epoch.Pin()){
+            assert(t._concurrent);
+            root = t._published.load();
+        }
+        Snapshot(Snapshot &&s): tree(s.tree), root(s.root), slot(s.slot){s.slot = -1;}
+        Snapshot(const Snapshot&) = delete;
+        Snapshot& operator=(const Snapshot&) = delete;
+        ~Snapshot(){
+            if(slot >= 0)
+                tree->_epoch.Unpin(slot);
+        }
+
+        // the query forms of the tree, on this version
+        template<typename F>
+        void Query(const Box &bb, F &&visit, QRRefine refine = QRRefine::Box) const{
+            auto leafVisit = [&visit](const Leafnode &leaf){return visit(leaf.cir);};
+            tree->Visit(root, BoxWindow{bb, refine == QRRefine::Exact}, leafVisit);
+        }
+        void Query(const Box &bb, std::vector<Payload> &out, QRRefine refine = QRRefine::Box) const{
+            Query(bb, [&out](const Payload &hit){
+                out.push_back(hit);
+                return true;
+            }, refine);
+        }
+        template<typename F>
+        void Query(const Box &bb, std::uint64_t tmin, std::uint64_t tmax, F &&visit, QRRefine refine = QRRefine::Box) const{
+            auto leafVisit = [&visit](const Leafnode &leaf){return visit(leaf.cir);};
+            tree->Visit(root, StampWindow{BoxWindow{bb, refine == QRRefine::Exact}, tmin, tmax}, leafVisit);
+        }
+        void Query(const Box &bb, std::uint64_t tmin, std::uint64_t tmax, std::vector<Payload> &out,
+            QRRefine refine = QRRefine::Box) const{
+            Query(bb, tmin, tmax, [&out](const Payload &hit){
+                out.push_back(hit);
+                return true;
+            }, refine);
+        }
+        QueryRange Iterate(const Box &bb, QRRefine refine = QRRefine::Box) const{
+            return QueryRange{QueryIterator(root, bb, refine)};
+        }
+        template<typename F>
+        void QueryBall(const Ball &ball, F &&visit) const{
+            auto leafVisit = [&visit](const Leafnode &leaf){return visit(leaf.cir);};
+            tree->Visit(root, BallWindow{ball}, leafVisit);
+        }
+        template<typename F>
+        void QueryPolygon(const Polygon &polygon, F &&visit) const{
+            static_assert(Dim == 2, "QueryPolygon needs a 2-D tree");
+            auto leafVisit = [&visit](const Leafnode &leaf){return visit(leaf.cir);};
+            tree->Visit(root, PolygonWindow{&polygon}, leafVisit);
+        }
+        template<typename F>
+        void QuerySegment(Scalar x0, Scalar y0, Scalar x1, Scalar y1, Scalar width, F &&visit) const{
+            static_assert(Dim == 2, "QuerySegment needs a 2-D tree");
+            auto leafVisit = [&visit](const Leafnode &leaf){return visit(leaf.cir);};
+            tree->Visit(root, SegmentWindow{Segment{x0, y0, x1, y1, width / 2}}, leafVisit);
+        }
+        bool Raycast(const Point &origin, const Point &dir, Neighbour &hit,
+            Scalar maxdist = std::numeric_limits<Scalar>::infinity()) const{
+            return tree->RayFirst(root, origin.data(), dir.data(), maxdist, hit);
+        }
+        std::vector<Neighbour> Nearest(const Point &p, std::size_t k) const{
+            std::vector<Neighbour> out;
+            NearestQueue queue;
+            tree->BestFirst(root, p.data(), k, std::numeric_limits<Scalar>::infinity(), out, queue);
+            return out;
+        }
+        void Nearest(const Point &p, std::size_t k, std::vector<Neighbour> &out, NearestQueue &queue) const{
+            tree->BestFirst(root, p.data(), k, std::numeric_limits<Scalar>::infinity(), out, queue);
+        }
+        Summary Aggregate(const Box &bb, QRRefine refine = QRRefine::Box) const{
+            return tree->Aggregate(root, BoxWindow{bb, refine == QRRefine::Exact});
+        }
+        std::size_t Count(const Box &bb, QRRefine refine = QRRefine::Box) const{return Aggregate(bb, refine).count;}
+        void Rasterize(const Box &bb, std::size_t width, std::size_t height, std::vector<std::uint32_t> &out,
+            QRRaster mode = QRRaster::Count) const{
+            out.assign(width * height, 0);
+            tree->Raster(root, tree->MakeGrid(bb, width, height, mode), out.data(), 1);
+        }
+        const Innernode *Get_root() const{return root;}
+    };
 
-    std::vector<Leafnode>* Query(const QRBoundingBox &bb);
-    void InsertData(Circle tar);
-    void Delete(QRNode target);
+    // Lets other threads read through Snapshot while this one keeps writing. There is
+    // still one writer at a time. Switch it while no snapshot is taken. Only a CompactStep
+    // pass under way is finished, nodes and handles stay where they are
+    void Set_concurrent(bool on);
+    Snapshot Read() const{return Snapshot(*this);}
+
+    // stamp is the insertion time, in any unit but never less than the last one. Without
+    // it the leaf gets the last stamp plus 1, a sequence number
+    Handle InsertData(Payload tar){return InsertData(std::move(tar), _stamp + 1);}
+    Handle InsertData(Payload tar, std::uint64_t stamp);
+
+    // Moves the payload of h to tar. The leaf stays where it is while it fits the box of its
+    // parent, which is only tightened when it does not. Then the parent may grow by
+    // QRTREE_UPDATE_GROWTH, else the leaf is reinserted. FIFO place and stamp stay. With
+    // concurrent readers the leaf is copied and h follows it. false if h is not valid
+    bool Update(Handle &h, Payload tar);
+    bool Valid(const Handle &h) const{return Resolve(h) != nullptr;}
+    // the payload of h, nullptr if h is not valid
+    const Payload* Get(const Handle &h) const{
+        const Leafnode *leaf = Resolve(h);
+        return leaf ? &leaf->cir : nullptr;
+    }
+    // a handle for a leaf found by a query, e.g. through QueryIterator::leaf()
+    Handle Get_handle(const Leafnode *leaf) const{return Handle{const_cast<Leafnode*>(leaf), leaf->id, MovesOf(leaf)};}
+
+    // algorithms of the inserts from now on, R* for both by default. Linear and quadratic
+    // splits with least area enlargement trade query speed for cheaper inserts
+    void Set_strategy(QRSplit split, QRChoose choose){
+        _split = split;
+        _choose = choose;
+    }
+
+    // Leaves expire from the front of the FIFO batch at a time, with one condense pass for
+    // the batch. With ttl 0 the oldest batch go once s + batch leaves are held, else once
+    // batch leaves are older than ttl, whatever their number. Batch 1 is one at a time
+    void Set_expiry(std::size_t batch, std::uint64_t ttl = 0);
+    // with a ttl, removes every leaf older than ttl at now, even less than a batch
+    void Expire(std::uint64_t now);
+    // removes every payload in the region, by bounding box or exactly as refine says
+    void Delete(Box target, QRRefine refine = QRRefine::Box);
+
+    // Moves the live nodes into fresh blocks, the inner nodes in depth-first order and the
+    // leaves of each leaf-parent next to each other in the same order, then frees the old
+    // slabs. After long churn this lets a query walk memory mostly forwards. Handles stay
+    // valid, one from before finds its leaf by id until it is refreshed by Update. Nothing
+    // happens with slab 0
+    void Compact(){
+        while(!CompactStep(std::numeric_limits<std::size_t>::max()))
+            ;
+    }
+    // the same in steps between other calls, each moving or passing over up to n nodes.
+    // true once the tree is compact. Not with concurrent readers
+    bool CompactStep(std::size_t n);
     
-    std::size_t Get_size(){return _size;}
+    // Walks the whole tree for its shape, so it costs about a query of everything; the
+    // counters alone are cheap. Not while the tree is written
+    Statistics Stats() const;
+    Counters Get_counters() const;
+    void ResetStats();
+
+    std::size_t Get_size() const{return _size;}
+    // the stamp of the newest payload, which InsertData without a stamp counts up from
+    std::uint64_t Get_stamp() const{return _stamp;}
     Innernode *Get_root(){return _root;}
+    const Innernode *Get_root() const{return _root;}
+    int Get_max_child() const{return max_child;}
 
 };
 
+#define QRTREE_TEMPLATE template<int Dim, typename Scalar, typename Payload>
+#define QRTREE_CLASS QRBasicTree<Dim, Scalar, Payload>
+
+QRTREE_TEMPLATE
+template<typename W, typename F>
+bool QRTREE_CLASS::InnerVisit(const Innernode *inode, const W &window, F &visit, Walk &walk) const{
+    ++walk.visited;
+    if(inode->leafchild){
+        walk.tested += inode->child.size();
+        for(auto i: inode->child){
+            if(!window.accept(*static_cast<const Leafnode*>(i)))
+                continue;
+            ++walk.returned;
+            if(!visit(*static_cast<const Leafnode*>(i)))
+                return false;
+        }
+    }
+    else{
+        for(auto i: inode->child)
+            if(window.enter(*static_cast<const Innernode*>(i)) && !InnerVisit(static_cast<const Innernode*>(i), window, visit, walk))
+                return false;
+    }
+    return true;
+}
+
+QRTREE_TEMPLATE
+template<typename F>
+void QRTREE_CLASS::Query(const Box &bb, F &&visit, QRRefine refine) const{
+    auto leafVisit = [&visit](const Leafnode &leaf){return visit(leaf.cir);};
+    Visit(_root, BoxWindow{bb, refine == QRRefine::Exact}, leafVisit);
+}
+
+QRTREE_TEMPLATE
+template<typename F>
+void QRTREE_CLASS::Query(const Box &bb, std::uint64_t tmin, std::uint64_t tmax, F &&visit, QRRefine refine) const{
+    auto leafVisit = [&visit](const Leafnode &leaf){return visit(leaf.cir);};
+    Visit(_root, StampWindow{BoxWindow{bb, refine == QRRefine::Exact}, tmin, tmax}, leafVisit);
+}
+
+QRTREE_TEMPLATE
+template<typename F>
+void QRTREE_CLASS::QueryBall(const Ball &ball, F &&visit) const{
+    auto leafVisit = [&visit](const Leafnode &leaf){return visit(leaf.cir);};
+    Visit(_root, BallWindow{ball}, leafVisit);
+}
+
+QRTREE_TEMPLATE
+template<typename F>
+void QRTREE_CLASS::QueryPolygon(const Polygon &polygon, F &&visit) const{
+    static_assert(Dim == 2, "QueryPolygon needs a 2-D tree");
+    auto leafVisit = [&visit](const Leafnode &leaf){return visit(leaf.cir);};
+    Visit(_root, PolygonWindow{&polygon}, leafVisit);
+}
+
+QRTREE_TEMPLATE
+template<typename F>
+void QRTREE_CLASS::QuerySegment(Scalar x0, Scalar y0, Scalar x1, Scalar y1, Scalar width, F &&visit) const{
+    static_assert(Dim == 2, "QuerySegment needs a 2-D tree");
+    auto leafVisit = [&visit](const Leafnode &leaf){return visit(leaf.cir);};
+    Visit(_root, SegmentWindow{Segment{x0, y0, x1, y1, width / 2}}, leafVisit);
+}
+
+// children of a and b that overlap the other node, in x order, then a sweep along x:
+// the entry that starts first is paired with those of the other side starting before it ends
+QRTREE_TEMPLATE
+template<typename G>
+bool QRTREE_CLASS::SweepPairs(const Innernode *a, const Innernode *b, std::vector<const Box*> &fa,
+    std::vector<const Box*> &fb, G &&pair){
+    auto byFirst = [](const Box *x, const Box *y){return x->range[0].first < y->range[0].first;};
+    fa.clear();
+    for(auto i: a->child)
+        if(i->overlaps(*b))
+            fa.push_back(i);
+    fb.clear();
+    if(!fa.empty())
+        for(auto i: b->child)
+            if(i->overlaps(*a))
+                fb.push_back(i);
+    if(fb.empty())
+        return true;
+    std::sort(fa.begin(), fa.end(), byFirst);
+    std::sort(fb.begin(), fb.end(), byFirst);
+
+    std::size_t i = 0, j = 0;
+    while(i < fa.size() && j < fb.size()){
+        if(fa[i]->range[0].first <= fb[j]->range[0].first){
+            for(std::size_t k = j; k < fb.size() && fb[k]->range[0].first <= fa[i]->range[0].second; ++k)
+                if(fa[i]->overlaps(*fb[k]) && !pair(fa[i], fb[k]))
+                    return false;
+            ++i;
+        }
+        else{
+            for(std::size_t k = i; k < fa.size() && fa[k]->range[0].first <= fb[j]->range[0].second; ++k)
+                if(fb[j]->overlaps(*fa[k]) && !pair(fa[k], fb[j]))
+                    return false;
+            ++j;
+        }
+    }
+    return true;
+}
+
+QRTREE_TEMPLATE
+template<typename G>
+bool QRTREE_CLASS::SweepSelf(const Innernode *a, std::vector<const Box*> &fa, G &&pair){
+    fa.assign(a->child.begin(), a->child.end());
+    std::sort(fa.begin(), fa.end(), [](const Box *x, const Box *y){return x->range[0].first < y->range[0].first;});
+    for(std::size_t i = 0; i < fa.size(); ++i)
+        for(std::size_t k = i + 1; k < fa.size() && fa[k]->range[0].first <= fa[i]->range[0].second; ++k)
+            if(fa[i]->overlaps(*fa[k]) && !pair(fa[i], fa[k]))
+                return false;
+    return true;
+}
+
+// the trees may differ in height, then only the deeper side goes on down once the other
+// has reached its leaves
+QRTREE_TEMPLATE
+template<typename E>
+bool QRTREE_CLASS::JoinNodes(const Innernode *a, const Innernode *b, E &emit, JoinScratch &scratch, int depth){
+    assert(2 * depth + 1 < (int)scratch.size());
+    auto &fa = scratch[2 * depth];
+    auto &fb = scratch[2 * depth + 1];
+
+    if(a->leafchild && b->leafchild)
+        return SweepPairs(a, b, fa, fb, [&emit](const Box *x, const Box *y){
+            return emit(*static_cast<const Leafnode*>(x), *static_cast<const Leafnode*>(y));
+        });
+    if(a->leafchild){
+        for(auto i: b->child)
+            if(i->overlaps(*a) && !JoinNodes(a, static_cast<const Innernode*>(i), emit, scratch, depth + 1))
+                return false;
+        return true;
+    }
+    if(b->leafchild){
+        for(auto i: a->child)
+            if(i->overlaps(*b) && !JoinNodes(static_cast<const Innernode*>(i), b, emit, scratch, depth + 1))
+                return false;
+        return true;
+    }
+    return SweepPairs(a, b, fa, fb, [&](const Box *x, const Box *y){
+        return JoinNodes(static_cast<const Innernode*>(x), static_cast<const Innernode*>(y), emit, scratch, depth + 1);
+    });
+}
+
+// the pairs below one child each, then those between two children
+QRTREE_TEMPLATE
+template<typename E>
+bool QRTREE_CLASS::JoinSelf(const Innernode *a, E &emit, JoinScratch &scratch, int depth){
+    assert(2 * depth + 1 < (int)scratch.size());
+    auto &fa = scratch[2 * depth];
+
+    if(a->leafchild)
+        return SweepSelf(a, fa, [&emit](const Box *x, const Box *y){
+            return emit(*static_cast<const Leafnode*>(x), *static_cast<const Leafnode*>(y));
+        });
+    for(auto i: a->child)
+        if(!JoinSelf(static_cast<const Innernode*>(i), emit, scratch, depth + 1))
+            return false;
+    return SweepSelf(a, fa, [&](const Box *x, const Box *y){
+        return JoinNodes(static_cast<const Innernode*>(x), static_cast<const Innernode*>(y), emit, scratch, depth + 1);
+    });
+}
+
+QRTREE_TEMPLATE
+template<typename E>
+void QRTREE_CLASS::JoinParallel(std::vector<JoinTask> &&tasks, E &&emit, QRThreadPool &pool){
+    // a few tasks per thread, so that stealing evens out their sizes
+    SplitJoin(tasks, 16 * pool.Get_size());
+    std::vector<JoinScratch> scratch(pool.Get_size(), JoinScratch(4 * QRTREE_MAX_HEIGHT));
+    pool.ParallelFor(tasks.size(), 1, [&](std::size_t begin, std::size_t end, unsigned t){
+        auto leafEmit = [&emit, t](const Leafnode &x, const Leafnode &y){
+            emit(x, y, t);
+            return true;
+        };
+        for(std::size_t i = begin; i < end; ++i){
+            if(tasks[i].b)
+                JoinNodes(tasks[i].a, tasks[i].b, leafEmit, scratch[t], 0);
+            else
+                JoinSelf(tasks[i].a, leafEmit, scratch[t], 0);
+        }
+    });
+}
+
+QRTREE_TEMPLATE
+template<typename F>
+void QRTREE_CLASS::Join(const QRBasicTree &other, F &&onPair, QRRefine refine) const{
+    if(!_root || !other._root)
+        return;
+    const bool exact = refine == QRRefine::Exact;
+    auto emit = [&onPair, exact](const Leafnode &x, const Leafnode &y){
+        return (exact && !Traits::overlaps(x.cir, y.cir)) || onPair(x.cir, y.cir);
+    };
+    JoinScratch scratch(4 * QRTREE_MAX_HEIGHT);
+    if(_root->overlaps(*other._root))
+        JoinNodes(_root, other._root, emit, scratch, 0);
+}
+
+QRTREE_TEMPLATE
+template<typename F>
+void QRTREE_CLASS::SelfJoin(F &&onPair, QRRefine refine) const{
+    if(!_root)
+        return;
+    const bool exact = refine == QRRefine::Exact;
+    auto emit = [&onPair, exact](const Leafnode &x, const Leafnode &y){
+        return (exact && !Traits::overlaps(x.cir, y.cir)) || onPair(x.cir, y.cir);
+    };
+    JoinScratch scratch(4 * QRTREE_MAX_HEIGHT);
+    JoinSelf(_root, emit, scratch, 0);
+}
+
+QRTREE_TEMPLATE
+template<typename F>
+void QRTREE_CLASS::Join(const QRBasicTree &other, F &&onPair, QRThreadPool &pool, QRRefine refine) const{
+    if(!_root || !other._root || !_root->overlaps(*other._root))
+        return;
+    const bool exact = refine == QRRefine::Exact;
+    JoinParallel({JoinTask{_root, other._root}}, [&onPair, exact](const Leafnode &x, const Leafnode &y, unsigned t){
+        if(!exact || Traits::overlaps(x.cir, y.cir))
+            onPair(x.cir, y.cir, t);
+    }, pool);
+}
+
+QRTREE_TEMPLATE
+template<typename F>
+void QRTREE_CLASS::SelfJoin(F &&onPair, QRThreadPool &pool, QRRefine refine) const{
+    if(!_root)
+        return;
+    const bool exact = refine == QRRefine::Exact;
+    JoinParallel({JoinTask{_root, nullptr}}, [&onPair, exact](const Leafnode &x, const Leafnode &y, unsigned t){
+        if(!exact || Traits::overlaps(x.cir, y.cir))
+            onPair(x.cir, y.cir, t);
+    }, pool);
+}
+
+#include "qrtree_impl.hpp"
+
+// the tree as it always was, 2-D double coordinates and Circle leaves. It is compiled
+// into the library once, other trees are instantiated where they are used
+typedef QRBasicTree<2, double, Circle> QRTree;
+typedef QRTree::BoxWindow QRBoxWindow;
+typedef QRTree::BallWindow QRCircleWindow;
+typedef QRTree::QueryIterator QRQueryIterator;
+typedef QRTree::QueryRange QRQueryRange;
+typedef QRTree::Neighbour QRNeighbour;
+typedef QRTree::BatchResult QRBatchResult;
+typedef QRTree::Handle QRHandle;
+typedef QRTree::Statistics QRStatistics;
+typedef QRTree::Summary QRSummary;
+typedef QRTree::Polygon QRPolygon;
 
+extern template struct QRBasicTree<2, double, Circle>;
 
 #endif
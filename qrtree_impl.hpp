@@ -0,0 +1,2272 @@
+/*
+ *  Copyright (c) 2008 Dustin Spicuzza <dustin@virtualroadside.com>
+ *  Copyright (c) 2018 Zuoshui Zhou <zuoshui.zhou@gmail.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of version 2.1 of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+/*
+ *  Members of QRBasicTree, included at the end of qrtree.hpp.
+ */
+
+#ifndef QRTREE_IMPL_HPP
+#define QRTREE_IMPL_HPP
+
+// end is last element, not its next position
+QRTREE_TEMPLATE
+typename QRTREE_CLASS::Handle QRTREE_CLASS::InsertData(Payload tar, std::uint64_t stamp){
+    assert(stamp >= _stamp);
+    _stamp = stamp;
+    Leafnode* newLeaf = NewLeaf(std::move(tar));
+    newLeaf->stamp = stamp;
+    const Handle handle{newLeaf, newLeaf->id, MovesOf(newLeaf)};
+
+    // the list may be empty while the root is not, after everything expired
+    newLeaf->prev = end;
+    newLeaf->next = nullptr;
+    if(end)
+        end->next = newLeaf;
+    else
+        front = newLeaf;
+    end = newLeaf;
+  
+    // if tree is still empty
+    if(_root == nullptr){
+        _root = NewInner(true);
+        _root->init();
+        _root->expandToContain(*newLeaf);
+
+        _root->child.push_back(newLeaf);
+        newLeaf->parent = _root;
+        Summarise(_root);
+    }
+    else
+        Insert(newLeaf, _root);
+        
+    _size++;
+    Notify(*newLeaf, QREvent::Entered);
+    if(_ttl == 0){
+        if(_size >= _size_full + _expire_batch)
+            ExpireFront(_size - _size_full);
+    }
+    else if(stamp >= _expire_at){
+        // stamps are in order, so the batch is due once its last leaf is
+        const Leafnode *last = front;
+        for(std::size_t i = 1; last && i < _expire_batch; ++i)
+            last = last->next;
+        if(last && stamp - last->stamp >= _ttl){
+            ExpireFront(Due(stamp, _size));
+            _expire_at = 0;
+        }
+        else
+            _expire_at = (last ? last->stamp : stamp) + _ttl;
+    }
+    Publish();
+    return handle;
+}
+
+QRTREE_TEMPLATE
+bool QRTREE_CLASS::Update(Handle &h, Payload tar){
+    Leafnode *leaf = Resolve(h);
+    if(!leaf)
+        return false;
+    h.leaf = leaf;
+    h.moves = MovesOf(leaf);
+
+    const Box bb = Traits::bounds(tar);
+    Innernode *parent = Own(leaf->parent);
+
+    // a tight parent around the other leaves and the new box, unless the old one holds it
+    Box tight = *parent;
+    if(!parent->contains(bb)){
+        tight = bb;
+        for(auto i: parent->child)
+            if(i != leaf)
+                tight.expandToContain(*i);
+    }
+
+    if(parent == _root || tight.area() <= parent->area() * (1 + QRTREE_UPDATE_GROWTH)){
+#if QRTREE_AGGREGATE
+        const Summary before = Traits::summary(leaf->cir);
+#endif
+        Notify(*leaf, QREvent::Left);
+        h.leaf = Rewrite(leaf, std::move(tar));
+        Notify(*h.leaf, QREvent::Entered);
+        if(h.leaf != leaf)
+            *std::find(parent->child.begin(), parent->child.end(), static_cast<Box*>(leaf)) = h.leaf;
+
+        // the boxes above only grow, up to the first that already holds it
+        static_cast<Box&>(*parent) = tight;
+        for(Innernode *i = parent->parent; i && !i->contains(tight); i = i->parent)
+            i->expandToContain(tight);
+#if QRTREE_AGGREGATE
+        // a move alone leaves the summaries as they are
+        if(Traits::summary(h.leaf->cir) != before)
+            for(Innernode *i = parent; i; i = i->parent)
+                Summarise(i);
+#endif
+        Publish();
+        return true;
+    }
+
+    // detached as DeleteLeaf does, but kept and inserted again
+    parent->child.erase(std::find(parent->child.begin(), parent->child.end(), static_cast<Box*>(leaf)));
+    CondenseTree(leaf);
+    Notify(*leaf, QREvent::Left);
+    h.leaf = Rewrite(leaf, std::move(tar));
+    Insert(h.leaf, _root);
+    Notify(*h.leaf, QREvent::Entered);
+    Publish();
+    return true;
+}
+
+QRTREE_TEMPLATE
+typename QRTREE_CLASS::Leafnode* QRTREE_CLASS::Rewrite(Leafnode *leaf, Payload &&tar){
+    if(!_concurrent){
+        static_cast<Box&>(*leaf) = Traits::bounds(tar);
+        leaf->cir = std::move(tar);
+        return leaf;
+    }
+
+    Leafnode *copy = NewLeaf(std::move(tar));
+    copy->parent = leaf->parent;
+    copy->prev = leaf->prev;
+    copy->next = leaf->next;
+    copy->stamp = leaf->stamp;
+    copy->id = leaf->id;
+    if(copy->prev)
+        copy->prev->next = copy;
+    else
+        front = copy;
+    if(copy->next)
+        copy->next->prev = copy;
+    else
+        end = copy;
+    FreeLeaf(leaf);
+    return copy;
+}
+
+QRTREE_TEMPLATE
+void QRTREE_CLASS::Set_expiry(std::size_t batch, std::uint64_t ttl){
+    assert(batch > 0);
+    _expire_batch = batch;
+    _ttl = ttl;
+    _expire_at = 0;
+}
+
+QRTREE_TEMPLATE
+void QRTREE_CLASS::Expire(std::uint64_t now){
+    if(_ttl == 0)
+        return;
+    ExpireFront(Due(now, _size));
+    Publish();
+}
+
+QRTREE_TEMPLATE
+std::size_t QRTREE_CLASS::Due(std::uint64_t now, std::size_t limit) const{
+    std::size_t n = 0;
+    for(const Leafnode *leaf = front; leaf && n < limit; leaf = leaf->next, ++n)
+        if(leaf->stamp > now || now - leaf->stamp < _ttl)
+            break;
+    return n;
+}
+
+// Removes the k oldest leaves. Each parent drops its expired children in one pass, and
+// the parents are condensed together.
+QRTREE_TEMPLATE
+void QRTREE_CLASS::ExpireFront(std::size_t k){
+    if(k == 0)
+        return;
+    assert(k <= _size);
+    if(k == 1 && front->next){
+        front = front->next;
+        DeleteLeaf(front->prev);
+        --_size;
+        return;
+    }
+
+    // own the parents before marking anything, Own() relinks the children of a copy
+    auto &parents = _expire_buf;
+    parents.clear();
+    Leafnode *leaf = front;
+    for(std::size_t i = 0; i < k; ++i, leaf = leaf->next)
+        parents.push_back(Own(leaf->parent));
+    std::sort(parents.begin(), parents.end());
+    parents.erase(std::unique(parents.begin(), parents.end()), parents.end());
+
+    // expired leaves are marked by a null parent
+    leaf = front;
+    for(std::size_t i = 0; i < k; ++i, leaf = leaf->next)
+        leaf->parent = nullptr;
+    for(auto p: parents)
+        p->child.erase(std::remove_if(p->child.begin(), p->child.end(), [](const Box *c){
+            return static_cast<const Leafnode*>(c)->parent == nullptr;
+        }), p->child.end());
+
+    leaf = front;
+    for(std::size_t i = 0; i < k; ++i){
+        Leafnode *next = leaf->next;
+        Notify(*leaf, QREvent::Left);
+        FreeLeaf(leaf);
+        leaf = next;
+    }
+    front = leaf;
+    if(front)
+        front->prev = nullptr;
+    else
+        end = nullptr;
+    _size -= k;
+
+    CondenseLevels(parents);
+}
+
+// parameter bb is the bound of leaf node
+QRTREE_TEMPLATE
+typename QRTREE_CLASS::Innernode* QRTREE_CLASS::ChooseSubTree(Innernode *inode, const Box *bb) const{
+    // the child boxes are gathered once into arrays, so that the kernels below
+    // don't chase a pointer for every comparison
+    auto &boxes = _choose_buf;
+    boxes.gather(inode->child);
+    const auto b = boxes.arrays();
+    const std::size_t n = b.n;
+
+    Scalar *enlargement = boxes.value.data();
+    QRAreaEnlargement(b, *bb, enlargement);
+
+    if(_choose == QRChoose::Revised)
+        return ChooseRevised(inode, bb, enlargement);
+
+    // 如果往下两层就是叶子
+    if(_choose == QRChoose::RStar && (static_cast<Innernode*>(inode->child[0]))->leafchild){
+        // candidates by ascending area enlargement, only the first P of them when the node is large
+        auto &order = boxes.order;
+        std::size_t sort_length = n;
+        if((max_child > QRTREE_CHOOSE_SUBTREE_P * 2/3) && (n > QRTREE_CHOOSE_SUBTREE_P)){
+            std::partial_sort(order.begin(), order.begin() + QRTREE_CHOOSE_SUBTREE_P, order.end(),
+                [enlargement](std::uint32_t i, std::uint32_t j){return enlargement[i] < enlargement[j];});
+            sort_length = QRTREE_CHOOSE_SUBTREE_P;
+        }
+
+        // least overlap enlargement, ties resolved by least area enlargement. The overlap of
+        // a child with itself is in both sums and cancels out
+        std::size_t omIndex = order[0];
+        Scalar overlap_min = std::numeric_limits<Scalar>::max();
+        for(std::size_t k = 0; k < sort_length; ++k){
+            const std::size_t i = order[k];
+            Box copy_node = *inode->child[i];
+            copy_node.expandToContain(*bb);
+
+            const Scalar overlap = QROverlapAreaSum(b, copy_node) - QROverlapAreaSum(b, *inode->child[i]);
+            if(overlap < overlap_min || (overlap == overlap_min && enlargement[i] < enlargement[omIndex])){
+                overlap_min = overlap;
+                omIndex = i;
+            }
+        }
+        // it must be an Innernode, or this method won't be called
+        return static_cast<Innernode*>(inode->child[omIndex]);
+    }
+
+    // else
+    return static_cast<Innernode*>(inode->child[std::min_element(enlargement, enlargement + n) - enlargement]);
+}
+
+// Beckmann and Seeger's revised R*-tree on every level: the smallest child that holds
+// bb as it is, else the children by perimeter enlargement. The first of them is taken
+// if growing it adds no overlap, else those up to the last one it would grow into are
+// the candidates, and the first whose growth adds no overlap, or the one adding least
+QRTREE_TEMPLATE
+typename QRTREE_CLASS::Innernode* QRTREE_CLASS::ChooseRevised(Innernode *inode, const Box *bb, const Scalar *enlargement) const{
+    auto &boxes = _choose_buf;
+    const auto b = boxes.arrays();
+    const std::size_t n = b.n;
+    auto &child = inode->child;
+
+    std::size_t best = n;
+    for(std::size_t i = 0; i < n; ++i)
+        if(enlargement[i] == 0 && child[i]->contains(*bb) && (best == n || child[i]->area() < child[best]->area()))
+            best = i;
+    if(best < n)
+        return static_cast<Innernode*>(child[best]);
+
+    // value is free once the area enlargement has been looked at
+    Scalar *perimeter = boxes.value.data();
+    for(std::size_t i = 0; i < n; ++i){
+        Box grown = *child[i];
+        grown.expandToContain(*bb);
+        perimeter[i] = grown.perimeter() - child[i]->perimeter();
+    }
+    auto &order = boxes.order;
+    std::sort(order.begin(), order.end(), [perimeter](std::uint32_t i, std::uint32_t j){return perimeter[i] < perimeter[j];});
+
+    Box first = *child[order[0]];
+    first.expandToContain(*bb);
+    std::size_t last = 0;
+    for(std::size_t k = 1; k < n; ++k)
+        if(first.overlapArea(*child[order[k]]) > child[order[0]]->overlapArea(*child[order[k]]))
+            last = k;
+    if(last == 0)
+        return static_cast<Innernode*>(child[order[0]]);
+
+    best = order[0];
+    Scalar least = std::numeric_limits<Scalar>::max();
+    for(std::size_t k = 0; k <= last; ++k){
+        const std::size_t i = order[k];
+        Box grown = *child[i];
+        grown.expandToContain(*bb);
+        const Scalar overlap = QROverlapAreaSum(b, grown) - QROverlapAreaSum(b, *child[i]);
+        if(overlap <= 0)
+            return static_cast<Innernode*>(child[i]);
+        if(overlap < least){
+            least = overlap;
+            best = i;
+        }
+    }
+    return static_cast<Innernode*>(child[best]);
+}
+
+QRTREE_TEMPLATE
+typename QRTREE_CLASS::Innernode* QRTREE_CLASS::Insert(Leafnode *leaf, Innernode *inode, bool firstInLevel){
+    inode = Own(inode);
+    inode->expandToContain(*leaf);  // type may not compatible
+    Summarise(inode, leaf);
+
+    if(inode->leafchild){
+        inode->child.push_back(leaf);
+        leaf->parent = inode;       // update parent pointer
+    }
+    else{
+        
+        Innernode *tmp_node = Insert(leaf, ChooseSubTree(inode, leaf), firstInLevel);
+
+        // no overflow
+        if(!tmp_node)
+            return nullptr;
+
+        // otherwise
+        inode->child.push_back(tmp_node);
+        tmp_node->parent = inode;
+    }
+
+    // after insertion, whether this node overflows
+    if(inode->child.size() > max_child){
+        // only OT could return a non-null pointer
+        return OverflowTreatment(inode, firstInLevel);
+    }
+    return nullptr;
+}
+
+QRTREE_TEMPLATE
+typename QRTREE_CLASS::Innernode* QRTREE_CLASS::Insert(Innernode *toInsert, Innernode *inode, bool firstInLevel){
+    inode = Own(inode);
+    inode->expandToContain(*toInsert);
+    Summarise(inode, toInsert);
+
+    if(inode->getLevel() == toInsert->getLevel() + 1){
+        inode->child.push_back(toInsert);
+        toInsert->parent = inode;
+    }
+    else{
+        assert(inode->getLevel() > toInsert->getLevel() + 1);
+        Innernode *tmp_node = Insert(toInsert, ChooseSubTree(inode, toInsert), firstInLevel);
+        if(!tmp_node)
+            return nullptr;
+
+        inode->child.push_back(tmp_node);
+        tmp_node->parent = inode;
+    }
+
+    // a forced reinsert works on leaves only
+    if(inode->child.size() > max_child)
+        return OverflowTreatment(inode, false);
+    return nullptr;
+}
+
+QRTREE_TEMPLATE
+typename QRTREE_CLASS::Innernode* QRTREE_CLASS::OverflowTreatment(Innernode *level, bool firstInLevel){
+    if(level != _root && firstInLevel && _split == QRSplit::RStar){
+        Reinsert(level);
+        return nullptr;
+    }
+
+    // new node generated
+    Innernode* splitItem = Split(level);
+
+    if(level == _root){
+        Innernode *newRoot = NewInner(false);
+
+        newRoot->child.push_back(_root);
+        newRoot->child.push_back(splitItem);
+
+        newRoot->init();
+        for(auto i: newRoot->child){
+            newRoot->expandToContain(*i);
+        }
+        Summarise(newRoot);
+
+        _root->parent = newRoot;
+        splitItem->parent = newRoot;
+
+        _root = newRoot;
+        _root->parent = nullptr;
+        ++_counters.root_changes;
+        
+        return nullptr;   
+    }
+
+    return splitItem;
+}
+
+QRTREE_TEMPLATE
+typename QRTREE_CLASS::Innernode* QRTREE_CLASS::Split(Innernode *inode){
+    Innernode *newNode = NewInner(inode->leafchild);
+    ++_counters.splits;
+
+    std::size_t split_index;
+    switch(_split){
+    case QRSplit::Quadratic:
+        split_index = SplitQuadratic(inode->child);
+        break;
+    case QRSplit::Linear:
+        split_index = SplitLinear(inode->child);
+        break;
+    default:
+        split_index = SplitRStar(inode->child);
+    }
+
+    newNode->child.assign(inode->child.begin() + split_index, inode->child.end());
+    
+    inode->child.erase(inode->child.begin() + split_index, inode->child.end());
+
+    inode->init();
+    std::for_each(inode->child.begin(), inode->child.end(), ExpandNode<Box>(inode));
+    Summarise(inode);
+
+    newNode->init();
+    std::for_each(newNode->child.begin(), newNode->child.end(), ExpandNode<Box>(newNode));
+    Summarise(newNode);
+
+    // 更新本点与孩子的关系
+    if(!newNode->leafchild)
+        for(auto i: newNode->child)
+            static_cast<Innernode*>(i)->parent = newNode;
+    else
+        for(auto i: newNode->child)
+            static_cast<Leafnode*>(i)->parent = newNode;
+    
+
+    return newNode;
+
+}
+
+// The boxes of the first i and the last n - i children of each sort are swept once
+// into prefix and suffix arrays, so a distribution costs two lookups
+QRTREE_TEMPLATE
+std::size_t QRTREE_CLASS::SplitRStar(std::vector<Box*> &child){
+    // child number
+    const std::size_t child_n = child.size();
+    // distribution number
+    const std::size_t distro_n = child_n - 2*min_child + 1;
+
+    auto &sweep = _sweep_buf;
+    sweep.resize(2 * child_n);
+    Box *prefix = sweep.data(), *suffix = sweep.data() + child_n;
+
+    std::size_t split_axis = Dim + 1, split_range = 0, split_index = 0;
+
+    Scalar split_margin = 0;
+
+    // 对每个维度
+    for(std::size_t axis = 0; axis < Dim; ++axis){
+        Scalar margin = 0;
+		Scalar overlap = 0, dist_area, dist_overlap;
+		std::size_t dist_range = 0, dist_index = 0;
+		
+		dist_area = dist_overlap = std::numeric_limits<Scalar>::max();
+
+        for(std::size_t r =0; r <2; ++r){
+            if(r == 0)
+                std::sort(child.begin(), child.end(), AscendingSortByFirstRange<Box>(axis));
+            else
+                std::sort(child.begin(), child.end(), AscendingSortBySecondRange<Box>(axis));
+
+            prefix[0] = *child[0];
+            for(std::size_t i = 1; i < child_n; ++i){
+                prefix[i] = prefix[i - 1];
+                prefix[i].expandToContain(*child[i]);
+            }
+            suffix[child_n - 1] = *child[child_n - 1];
+            for(std::size_t i = child_n - 1; i-- > 0; ){
+                suffix[i] = suffix[i + 1];
+                suffix[i].expandToContain(*child[i]);
+            }
+
+            // 对每个distro
+            for(std::size_t k =0; k< distro_n; ++k){
+                const Box &R1 = prefix[k + min_child - 1];
+                const Box &R2 = suffix[k + min_child];
+
+                margin += R1.perimeter() + R2.perimeter();
+                const Scalar area = R1.area() + R2.area();
+                overlap = R1.overlapArea(R2);
+
+                if(overlap < dist_overlap || (overlap == dist_overlap && area < dist_area)){
+                    dist_range  = r;
+                    dist_index = min_child+k;
+                    dist_overlap = overlap;
+                    dist_area = area;
+                }
+            }
+        }
+
+        // 第一个条件仅仅是为了开始split_margin为0可以继续运行
+        if(split_axis == Dim + 1 || split_margin > margin){
+            split_axis = axis;
+            split_margin = margin;
+            split_range = dist_range;
+            split_index = dist_index;
+        }
+    }
+
+    if(split_range == 0)
+        std::sort(child.begin(), child.end(), AscendingSortByFirstRange<Box>(split_axis));
+    
+    else if(split_axis != Dim -1)
+        std::sort(child.begin(), child.end(), AscendingSortBySecondRange<Box>(split_axis));
+
+    return split_index;
+}
+
+// seeds are the pair that would waste the most area in one node
+QRTREE_TEMPLATE
+std::size_t QRTREE_CLASS::SplitQuadratic(std::vector<Box*> &child){
+    const std::size_t n = child.size();
+    std::size_t s1 = 0, s2 = 1;
+    Scalar worst = std::numeric_limits<Scalar>::lowest();
+    for(std::size_t i = 0; i < n; ++i)
+        for(std::size_t j = i + 1; j < n; ++j){
+            Box both = *child[i];
+            both.expandToContain(*child[j]);
+            const Scalar waste = both.area() - child[i]->area() - child[j]->area();
+            if(waste > worst){
+                worst = waste;
+                s1 = i;
+                s2 = j;
+            }
+        }
+    return Distribute(child, s1, s2, true);
+}
+
+// seeds are the pair farthest apart on some axis, relative to the extent of all children
+// on that axis
+QRTREE_TEMPLATE
+std::size_t QRTREE_CLASS::SplitLinear(std::vector<Box*> &child){
+    const std::size_t n = child.size();
+    std::size_t s1 = 0, s2 = 1;
+    Scalar best = std::numeric_limits<Scalar>::lowest();
+    for(int d = 0; d < Dim; ++d){
+        std::size_t lowest_high = 0, highest_low = 0;
+        Scalar lo = child[0]->range[d].first, hi = child[0]->range[d].second;
+        for(std::size_t i = 1; i < n; ++i){
+            if(child[i]->range[d].second < child[lowest_high]->range[d].second)
+                lowest_high = i;
+            if(child[i]->range[d].first > child[highest_low]->range[d].first)
+                highest_low = i;
+            lo = std::min(lo, child[i]->range[d].first);
+            hi = std::max(hi, child[i]->range[d].second);
+        }
+        if(lowest_high == highest_low)
+            continue;
+        Scalar separation = child[highest_low]->range[d].first - child[lowest_high]->range[d].second;
+        if(hi > lo)
+            separation /= hi - lo;
+        if(separation > best){
+            best = separation;
+            s1 = lowest_high;
+            s2 = highest_low;
+        }
+    }
+    return Distribute(child, s1, s2, false);
+}
+
+// the first group fills child from the front, the second from the back
+QRTREE_TEMPLATE
+std::size_t QRTREE_CLASS::Distribute(std::vector<Box*> &child, std::size_t s1, std::size_t s2, bool pickNext){
+    const std::size_t n = child.size();
+    auto &rest = _split_buf;
+    rest.clear();
+    for(std::size_t i = 0; i < n; ++i)
+        if(i != s1 && i != s2)
+            rest.push_back(child[i]);
+
+    auto growth = [](const Box &group, const Box *item){
+        Box grown = group;
+        grown.expandToContain(*item);
+        return grown.area() - group.area();
+    };
+    Box *seed1 = child[s1], *seed2 = child[s2];
+    Box B1 = *seed1, B2 = *seed2;
+    std::size_t head = 0, tail = n;
+    child[head++] = seed1;
+    child[--tail] = seed2;
+
+    while(!rest.empty()){
+        // a group that needs every entry left to reach min_child gets them
+        if(head + rest.size() == (std::size_t)min_child){
+            for(auto i: rest)
+                child[head++] = i;
+            break;
+        }
+        if(n - tail + rest.size() == (std::size_t)min_child){
+            for(auto i: rest)
+                child[--tail] = i;
+            break;
+        }
+
+        std::size_t next = rest.size() - 1;
+        if(pickNext){
+            Scalar most = std::numeric_limits<Scalar>::lowest();
+            for(std::size_t i = 0; i < rest.size(); ++i){
+                const Scalar preference = std::abs(growth(B1, rest[i]) - growth(B2, rest[i]));
+                if(preference > most){
+                    most = preference;
+                    next = i;
+                }
+            }
+        }
+        Box *item = rest[next];
+        rest[next] = rest.back();
+        rest.pop_back();
+
+        // least enlargement, then smaller area, then fewer entries
+        const Scalar d1 = growth(B1, item), d2 = growth(B2, item);
+        if(d1 < d2 || (d1 == d2 && (B1.area() < B2.area() || (B1.area() == B2.area() && head <= n - tail)))){
+            child[head++] = item;
+            B1.expandToContain(*item);
+        }
+        else{
+            child[--tail] = item;
+            B2.expandToContain(*item);
+        }
+    }
+    assert(head == tail);
+    return head;
+}
+
+QRTREE_TEMPLATE
+void QRTREE_CLASS::Reinsert(Innernode *inode){
+    inode = Own(inode);
+    auto &removed_items = _reinsert_buf;
+
+    const std::size_t n_items = inode->child.size();
+    // 如果30%的M是存在的，则使用这个值，否则就使用1，依P327左下段的描述。只reinsert这些元素
+    const std::size_t p = (std::size_t)((double)n_items * QRTREE_REINSERT_P) > 0 ? (std::size_t)((double)n_items * QRTREE_REINSERT_P) : 1;
+
+    // RI1
+    assert(n_items == max_child + 1);
+
+    // RI 2
+    std::partial_sort(inode->child.begin(), inode->child.end() - p, inode->child.end(), AscendingSortByDistance<Box>(inode));
+
+    if(inode->leafchild){
+        removed_items.assign(inode->child.end()-p, inode->child.end());
+
+        inode->child.erase(inode->child.end() - p, inode->child.end());
+        _counters.reinserts += p;
+    
+        // RI3
+        inode->init();
+        std::for_each(inode->child.begin(), inode->child.end(), ExpandNode<Box>(inode));
+        // the nodes above counted the removed leaves, which are now counted again on
+        // the way down
+        for(Innernode *i = inode; i; i = i->parent)
+            Summarise(i);
+
+        for(auto i : removed_items){
+            Insert(static_cast<Leafnode*>(i), _root, false);
+        }
+    }
+    else{
+        for(auto i: inode->child)
+            Reinsert(static_cast<Innernode*>(i));
+    }
+    
+}
+
+QRTREE_TEMPLATE
+std::vector<typename QRTREE_CLASS::Leafnode>* QRTREE_CLASS::Query(const Box &bb, QRRefine refine){
+    auto result = new std::vector<Leafnode>;
+    auto leafVisit = [result](const Leafnode &leaf){
+        result->push_back(leaf);
+        return true;
+    };
+    Visit(_root, BoxWindow{bb, refine == QRRefine::Exact}, leafVisit);
+    return result;
+}
+
+QRTREE_TEMPLATE
+void QRTREE_CLASS::Query(const Box &bb, std::vector<Payload> &out, QRRefine refine) const{
+    Query(bb, [&out](const Payload &cir){
+        out.push_back(cir);
+        return true;
+    }, refine);
+}
+
+QRTREE_TEMPLATE
+void QRTREE_CLASS::Set_query_cache(std::size_t bytes){
+    _cache_limit = bytes;
+    EvictCache();
+}
+
+QRTREE_TEMPLATE
+void QRTREE_CLASS::CachedQuery(const Box &bb, std::vector<Payload> &out, QRRefine refine){
+    if(_cache_limit == 0){
+        Query(bb, out, refine);
+        return;
+    }
+
+    const CacheKey key{bb, refine == QRRefine::Exact};
+    auto found = _cache_index.find(key);
+    auto entry = _cache.begin();
+    if(found != _cache_index.end()){
+        entry = found->second;
+        _cache.splice(_cache.begin(), _cache, entry);
+        std::size_t matched = 0;
+        const bool holds = _root && _root->overlaps(bb) ?
+            CacheHolds(_root, *entry, matched) && matched == entry->leafparents : entry->leafparents == 0;
+        if(holds){
+            ++_counters.cache_hits;
+            out.insert(out.end(), entry->result.begin(), entry->result.end());
+            return;
+        }
+        _cache_bytes -= entry->bytes;
+    }
+    else{
+        _cache.emplace_front();
+        entry = _cache.begin();
+        entry->key = key;
+        _cache_index.emplace(key, entry);
+    }
+
+    ++_counters.cache_misses;
+    FillCache(*entry);
+    out.insert(out.end(), entry->result.begin(), entry->result.end());
+    _cache_bytes += entry->bytes;
+    EvictCache();
+}
+
+QRTREE_TEMPLATE
+void QRTREE_CLASS::FillCache(CacheEntry &entry){
+    // nodes written from here on have a version as high as the entry's
+    entry.version = ++_version;
+    entry.result.clear();
+    entry.frontier.clear();
+    Walk walk;
+    const BoxWindow window{entry.key.window, entry.key.exact};
+    entry.leafparents = _root && _root->overlaps(window.bb) ? InnerFillCache(_root, window, entry, walk) : 0;
+    Count(walk);
+    std::sort(entry.frontier.begin(), entry.frontier.end());
+    // with the list and index nodes
+    entry.bytes = sizeof(CacheEntry) + 8 * sizeof(void*) + entry.result.capacity() * sizeof(Payload) +
+        entry.frontier.capacity() * sizeof(entry.frontier[0]);
+}
+
+QRTREE_TEMPLATE
+std::size_t QRTREE_CLASS::InnerFillCache(const Innernode *inode, const BoxWindow &window, CacheEntry &entry, Walk &walk) const{
+    ++walk.visited;
+    std::size_t below = 0;
+    if(inode->leafchild){
+        walk.tested += inode->child.size();
+        for(auto i: inode->child)
+            if(window.accept(*static_cast<const Leafnode*>(i))){
+                entry.result.push_back(static_cast<const Leafnode*>(i)->cir);
+                ++walk.returned;
+            }
+        below = 1;
+    }
+    else
+        for(auto i: inode->child)
+            if(window.enter(*i))
+                below += InnerFillCache(static_cast<const Innernode*>(i), window, entry, walk);
+    entry.frontier.emplace_back(inode, below);
+    return below;
+}
+
+// An unchanged node was entered by the query, so it is in the frontier, and the nodes
+// found unchanged lie in separate subtrees. Every leaf-parent the query entered is below
+// one of them iff they add up to all of them, and any other leaf-parent the window meets
+// has changed and is reached through its changed path.
+QRTREE_TEMPLATE
+bool QRTREE_CLASS::CacheHolds(const Innernode *inode, const CacheEntry &entry, std::size_t &matched) const{
+    if(inode->version < entry.version){
+        auto at = std::lower_bound(entry.frontier.begin(), entry.frontier.end(),
+            std::make_pair(inode, std::size_t(0)));
+        if(at == entry.frontier.end() || at->first != inode)
+            return false;
+        matched += at->second;
+        return true;
+    }
+    if(inode->leafchild)
+        return false;
+    for(auto i: inode->child)
+        if(i->overlaps(entry.key.window) && !CacheHolds(static_cast<const Innernode*>(i), entry, matched))
+            return false;
+    return true;
+}
+
+QRTREE_TEMPLATE
+void QRTREE_CLASS::EvictCache(){
+    while(!_cache.empty() && _cache_bytes > _cache_limit){
+        _cache_index.erase(_cache.back().key);
+        _cache_bytes -= _cache.back().bytes;
+        _cache.pop_back();
+    }
+}
+
+QRTREE_TEMPLATE
+std::size_t QRTREE_CLASS::Subscribe(const Box &bb, std::function<void(const Payload&, QREvent)> callback,
+    QRRefine refine){
+    Query(bb, [&callback](const Payload &hit){
+        callback(hit, QREvent::Entered);
+        return true;
+    }, refine);
+
+    if(_subs.empty())
+        _subs_bound = bb;
+    else
+        _subs_bound.expandToContain(bb);
+    _subs.push_back(Subscription{++_sub_ids, BoxWindow{bb, refine == QRRefine::Exact}, std::move(callback)});
+    return _sub_ids;
+}
+
+QRTREE_TEMPLATE
+bool QRTREE_CLASS::Unsubscribe(std::size_t id){
+    auto at = std::find_if(_subs.begin(), _subs.end(), [id](const Subscription &sub){return sub.id == id;});
+    if(at == _subs.end())
+        return false;
+    _subs.erase(at);
+    if(!_subs.empty()){
+        _subs_bound = _subs[0].window.bb;
+        for(auto &sub: _subs)
+            _subs_bound.expandToContain(sub.window.bb);
+    }
+    return true;
+}
+
+QRTREE_TEMPLATE
+void QRTREE_CLASS::QueryBall(const Ball &ball, std::vector<Payload> &out) const{
+    QueryBall(ball, [&out](const Payload &hit){
+        out.push_back(hit);
+        return true;
+    });
+}
+
+// Every thread writes its hits to its own scratch and notes where those of a window start,
+// then the scratch is gathered into result.hits in window order.
+QRTREE_TEMPLATE
+void QRTREE_CLASS::QueryBatch(const std::vector<Box> &windows, BatchResult &result, QRThreadPool &pool,
+    bool group, QRRefine refine) const{
+    const std::size_t n = windows.size();
+    const bool exact = refine == QRRefine::Exact;
+
+    result.scratch.resize(pool.Get_size());
+    for(auto &s: result.scratch)
+        s.hits.clear();
+    result.thread.resize(n);
+    result.first.resize(n);
+    // the count of window i goes to offset[i + 1] until the prefix sum below
+    result.offset.assign(n + 1, 0);
+    result.order.resize(n);
+    for(std::size_t i = 0; i < n; ++i)
+        result.order[i] = std::make_pair(std::uint64_t(0), (std::uint32_t)i);
+
+    if(group){
+        Box bound;
+        bound.init();
+        for(auto &w: windows)
+            bound.expandToContain(w);
+        for(auto &o: result.order)
+            o.first = CurveKey(bound, windows[o.second]);
+        std::sort(result.order.begin(), result.order.end());
+    }
+
+    auto run = [&](std::size_t begin, std::size_t end, unsigned t){
+        auto &s = result.scratch[t];
+        Walk walk;
+
+        if(!group){
+            for(std::size_t k = begin; k < end; ++k){
+                const std::uint32_t i = result.order[k].second;
+                result.thread[i] = t;
+                result.first[i] = s.hits.size();
+                auto leafVisit = [&s](const Leafnode &leaf){
+                    s.hits.push_back(leaf.cir);
+                    return true;
+                };
+                if(_root)
+                    InnerVisit(_root, BoxWindow{windows[i], exact}, leafVisit, walk);
+                result.offset[i + 1] = s.hits.size() - result.first[i];
+            }
+            Count(walk, end - begin);
+            return;
+        }
+
+        // pieces are at most the grain of 64, one bit per window
+        assert(end - begin <= 64);
+        const std::size_t m = end - begin;
+        BoxWindow w[64];
+        Box bound;
+        bound.init();
+        std::uint64_t mask = 0;
+        for(std::size_t j = 0; j < m; ++j){
+            w[j] = BoxWindow{windows[result.order[begin + j].second], exact};
+            bound.expandToContain(w[j].bb);
+            if(_root && w[j].enter(*_root))
+                mask |= std::uint64_t(1) << j;
+        }
+        s.grouped.clear();
+        if(mask)
+            InnerGroup(_root, bound, w, mask, s.grouped, walk);
+        walk.returned = s.grouped.size();
+        Count(walk, m);
+
+        // counting sort of the hits by window, each window keeps the order of its walk
+        std::size_t count[64] = {0}, at[64];
+        for(auto &hit: s.grouped)
+            ++count[hit.first];
+        std::size_t base = s.hits.size();
+        s.hits.resize(base + s.grouped.size());
+        for(std::size_t j = 0; j < m; ++j){
+            const std::uint32_t i = result.order[begin + j].second;
+            result.thread[i] = t;
+            result.first[i] = at[j] = base;
+            result.offset[i + 1] = count[j];
+            base += count[j];
+        }
+        for(auto &hit: s.grouped)
+            s.hits[at[hit.first]++] = hit.second->cir;
+    };
+    pool.ParallelFor(n, group ? 64 : 16, run);
+
+    for(std::size_t i = 0; i < n; ++i)
+        result.offset[i + 1] += result.offset[i];
+
+    // one thread in window order left the hits where they belong
+    if(!group && pool.Get_size() == 1){
+        std::swap(result.hits, result.scratch[0].hits);
+        return;
+    }
+    result.hits.resize(result.offset[n]);
+
+    pool.ParallelFor(n, 256, [&](std::size_t begin, std::size_t end, unsigned){
+        for(std::size_t i = begin; i < end; ++i){
+            const Payload *from = result.scratch[result.thread[i]].hits.data() + result.first[i];
+            std::copy(from, from + (result.offset[i + 1] - result.offset[i]), result.hits.begin() + result.offset[i]);
+        }
+    });
+}
+
+QRTREE_TEMPLATE
+void QRTREE_CLASS::InnerGroup(const Innernode *inode, const Box &bound, const BoxWindow *windows, std::uint64_t mask,
+    std::vector<std::pair<std::uint32_t, const Leafnode*>> &out, Walk &walk) const{
+    ++walk.visited;
+    for(auto i: inode->child){
+        // most children are outside all of the windows, one test for them
+        if(!i->overlaps(bound))
+            continue;
+        if(inode->leafchild){
+            auto leaf = static_cast<const Leafnode*>(i);
+            walk.tested += __builtin_popcountll(mask);
+            for(std::uint64_t m = mask; m; m &= m - 1){
+                const std::uint32_t j = __builtin_ctzll(m);
+                if(windows[j].accept(*leaf))
+                    out.emplace_back(j, leaf);
+            }
+        }
+        else{
+            std::uint64_t sub = 0;
+            for(std::uint64_t m = mask; m; m &= m - 1){
+                const int j = __builtin_ctzll(m);
+                if(windows[j].enter(*i))
+                    sub |= std::uint64_t(1) << j;
+            }
+            if(sub)
+                InnerGroup(static_cast<const Innernode*>(i), bound, windows, sub, out, walk);
+        }
+    }
+}
+
+QRTREE_TEMPLATE
+typename QRTREE_CLASS::Summary QRTREE_CLASS::Aggregate(const Innernode *root, const BoxWindow &window) const{
+    Summary sum;
+    Walk walk;
+    if(root && window.enter(*root))
+        InnerAggregate(root, window, sum, walk);
+    walk.returned = sum.count;
+    Count(walk);
+    return sum;
+}
+
+QRTREE_TEMPLATE
+void QRTREE_CLASS::InnerAggregate(const Innernode *inode, const BoxWindow &window, Summary &sum, Walk &walk) const{
+    ++walk.visited;
+#if QRTREE_AGGREGATE
+    // every leaf below is accepted, the exact test too as the payload lies in its box
+    if(window.bb.contains(*inode)){
+        sum.add(inode->summary);
+        return;
+    }
+#endif
+    if(inode->leafchild){
+        walk.tested += inode->child.size();
+        for(auto i: inode->child)
+            if(window.accept(*static_cast<const Leafnode*>(i)))
+                sum.add(Traits::summary(static_cast<const Leafnode*>(i)->cir));
+    }
+    else{
+        for(auto i: inode->child)
+            if(window.enter(*i))
+                InnerAggregate(static_cast<const Innernode*>(i), window, sum, walk);
+    }
+}
+
+QRTREE_TEMPLATE
+typename QRTREE_CLASS::RasterGrid QRTREE_CLASS::MakeGrid(const Box &bb, std::size_t width, std::size_t height,
+    QRRaster mode) const{
+    static_assert(Dim >= 2, "Rasterize needs at least 2 axes");
+    assert(width > 0 && height > 0);
+    RasterGrid grid;
+    grid.bb = bb;
+    grid.size[0] = width;
+    grid.size[1] = height;
+    for(int i = 0; i < 2; ++i)
+        grid.scale[i] = grid.size[i] / (bb.range[i].second - bb.range[i].first);
+    grid.row0 = 0;
+    grid.row1 = height;
+    grid.mode = mode;
+    return grid;
+}
+
+QRTREE_TEMPLATE
+void QRTREE_CLASS::Raster(const Innernode *root, const RasterGrid &grid, std::uint32_t *out, std::size_t queries) const{
+    Walk walk;
+    if(root && root->overlaps(grid.bb))
+        InnerRaster(root, grid, grid.bb.contains(*root), out, walk);
+    Count(walk, queries);
+}
+
+QRTREE_TEMPLATE
+void QRTREE_CLASS::InnerRaster(const Innernode *inode, const RasterGrid &grid, bool inside, std::uint32_t *out,
+    Walk &walk) const{
+    ++walk.visited;
+    const std::size_t width = grid.size[0];
+    if(inode->leafchild){
+        walk.tested += inode->child.size();
+        for(auto i: inode->child){
+            const Box &b = *i;
+            if(grid.mode == QRRaster::Count){
+                bool in = true;
+                for(int d = 0; d < Dim && !inside && in; ++d){
+                    const Scalar c = (b.range[d].first + b.range[d].second) / 2;
+                    in = c >= grid.bb.range[d].first && c <= grid.bb.range[d].second;
+                }
+                if(!in)
+                    continue;
+                const std::size_t y = grid.cellOf(1, (b.range[1].first + b.range[1].second) / 2);
+                if(y < grid.row0 || y >= grid.row1)
+                    continue;
+                ++out[y * width + grid.cellOf(0, (b.range[0].first + b.range[0].second) / 2)];
+                ++walk.returned;
+                continue;
+            }
+
+            if(!inside && !b.overlaps(grid.bb))
+                continue;
+            const std::size_t x0 = grid.cellOf(0, b.range[0].first), x1 = grid.cellOf(0, b.range[0].second);
+            const std::size_t y0 = std::max(grid.row0, grid.cellOf(1, b.range[1].first));
+            const std::size_t y1 = std::min(grid.row1 - 1, grid.cellOf(1, b.range[1].second));
+            if(y0 > y1)
+                continue;
+            for(std::size_t y = y0; y <= y1; ++y)
+                for(std::size_t x = x0; x <= x1; ++x)
+                    ++out[y * width + x];
+            ++walk.returned;
+        }
+        return;
+    }
+
+    for(auto i: inode->child){
+        const Innernode *child = static_cast<const Innernode*>(i);
+        if(!inside && !child->overlaps(grid.bb))
+            continue;
+        const std::size_t y0 = grid.cellOf(1, child->range[1].first), y1 = grid.cellOf(1, child->range[1].second);
+        if(y1 < grid.row0 || y0 >= grid.row1)
+            continue;
+        const bool in = inside || grid.bb.contains(*child);
+#if QRTREE_AGGREGATE
+        // every payload below lies in bb and, box or centre, in this one cell
+        if(in && y0 == y1){
+            const std::size_t x = grid.cellOf(0, child->range[0].first);
+            if(x == grid.cellOf(0, child->range[0].second)){
+                out[y0 * width + x] += child->summary.count;
+                walk.returned += child->summary.count;
+                continue;
+            }
+        }
+#endif
+        InnerRaster(child, grid, in, out, walk);
+    }
+}
+
+QRTREE_TEMPLATE
+void QRTREE_CLASS::Rasterize(const Box &bb, std::size_t width, std::size_t height, std::vector<std::uint32_t> &out,
+    QRThreadPool &pool, QRRaster mode) const{
+    out.assign(width * height, 0);
+    const RasterGrid grid = MakeGrid(bb, width, height, mode);
+    // a few bands per thread, so that stealing evens out the dense ones. Every band walks
+    // down from the root, cells are still placed on the whole grid
+    const std::size_t bands = std::min(height, std::size_t(pool.Get_size()) * 4);
+    pool.ParallelFor(bands, 1, [&](std::size_t begin, std::size_t end, unsigned){
+        RasterGrid band = grid;
+        band.row0 = height * begin / bands;
+        band.row1 = height * end / bands;
+        Raster(_root, band, out.data(), begin == 0);
+    });
+}
+
+// one level at a time, a task whose nodes are both leaf-parents is kept as it is
+QRTREE_TEMPLATE
+void QRTREE_CLASS::SplitJoin(std::vector<JoinTask> &tasks, std::size_t n){
+    std::vector<const Box*> fa, fb;
+    std::vector<JoinTask> below;
+    auto push = [&below](const Box *x, const Box *y){
+        below.push_back(JoinTask{static_cast<const Innernode*>(x), static_cast<const Innernode*>(y)});
+        return true;
+    };
+
+    bool split = true;
+    while(tasks.size() < n && split){
+        split = false;
+        below.clear();
+        for(auto &task: tasks){
+            const Innernode *a = task.a, *b = task.b;
+            if(a->leafchild && (!b || b->leafchild)){
+                below.push_back(task);
+                continue;
+            }
+            split = true;
+            if(!b){
+                for(auto i: a->child)
+                    below.push_back(JoinTask{static_cast<const Innernode*>(i), nullptr});
+                SweepSelf(a, fa, push);
+            }
+            else if(a->leafchild){
+                for(auto i: b->child)
+                    if(i->overlaps(*a))
+                        push(a, i);
+            }
+            else if(b->leafchild){
+                for(auto i: a->child)
+                    if(i->overlaps(*b))
+                        push(i, b);
+            }
+            else
+                SweepPairs(a, b, fa, fb, push);
+        }
+        tasks.swap(below);
+    }
+}
+
+QRTREE_TEMPLATE
+std::vector<typename QRTREE_CLASS::Neighbour> QRTREE_CLASS::Nearest(const Point &p, std::size_t k) const{
+    std::vector<Neighbour> out;
+    NearestQueue queue;
+    BestFirst(_root, p.data(), k, std::numeric_limits<Scalar>::infinity(), out, queue);
+    return out;
+}
+
+QRTREE_TEMPLATE
+std::vector<typename QRTREE_CLASS::Neighbour> QRTREE_CLASS::WithinDistance(const Point &p, Scalar d) const{
+    std::vector<Neighbour> out;
+    NearestQueue queue;
+    BestFirst(_root, p.data(), std::numeric_limits<std::size_t>::max(), d, out, queue);
+    return out;
+}
+
+// Best-first as below, keyed by where the ray enters the box of a node, which is no later
+// than where it meets anything in it. The walk ends at the first node entered beyond the
+// nearest hit so far.
+QRTREE_TEMPLATE
+bool QRTREE_CLASS::RayFirst(const Innernode *root, const Scalar *origin, const Scalar *direction, Scalar maxdist, Neighbour &hit) const{
+    const Scalar inf = std::numeric_limits<Scalar>::infinity();
+    Scalar o[Dim], dir[Dim], len = 0;
+    for(int i = 0; i < Dim; ++i){
+        o[i] = origin[i];
+        len += direction[i] * direction[i];
+    }
+    len = std::sqrt(len);
+    if(!root || len == 0)
+        return false;
+    for(int i = 0; i < Dim; ++i)
+        dir[i] = direction[i] / len;
+
+    struct Entry{
+        Scalar dist;
+        const Innernode *node;
+    };
+    auto farther = [](const Entry &a, const Entry &b){return a.dist > b.dist;};
+
+    Walk walk;
+    Scalar bound = maxdist;
+    const Leafnode *best = nullptr;
+    std::vector<Entry> queue;
+    const Scalar at = root->rayEntry(o, dir);
+    if(at < inf && at <= bound)
+        queue.push_back(Entry{at, root});
+
+    while(!queue.empty()){
+        std::pop_heap(queue.begin(), queue.end(), farther);
+        const Entry e = queue.back();
+        queue.pop_back();
+
+        if(e.dist > bound || (best && e.dist == bound))
+            break;
+        ++walk.visited;
+
+        if(e.node->leafchild){
+            walk.tested += e.node->child.size();
+            for(auto i: e.node->child){
+                const Leafnode *leaf = static_cast<const Leafnode*>(i);
+                if(leaf->rayEntry(o, dir) > bound)
+                    continue;
+                const Scalar d = Traits::rayEntry(leaf->cir, o, dir);
+                if(d < inf && (d < bound || (!best && d == bound))){
+                    bound = d;
+                    best = leaf;
+                }
+            }
+            continue;
+        }
+
+        for(auto i: e.node->child){
+            const Scalar d = i->rayEntry(o, dir);
+            if(d < inf && d <= bound){
+                queue.push_back(Entry{d, static_cast<const Innernode*>(i)});
+                std::push_heap(queue.begin(), queue.end(), farther);
+            }
+        }
+    }
+
+    if(best){
+        hit = Neighbour{best->cir, bound};
+        ++walk.returned;
+    }
+    Count(walk);
+    return best != nullptr;
+}
+
+// Best-first over the inner nodes, keyed by the distance to their box, which bounds the
+// distance to every payload below. Leaves are measured exactly when their parent is
+// expanded and kept in a max-heap of the k best so far, whose top then bounds the search.
+QRTREE_TEMPLATE
+void QRTREE_CLASS::BestFirst(const Innernode *root, const Scalar *query, std::size_t k, Scalar maxdist,
+    std::vector<Neighbour> &out, NearestQueue &heap) const{
+    // a local copy, which the compiler knows out does not alias
+    Scalar point[Dim];
+    std::copy(query, query + Dim, point);
+
+    typedef typename NearestQueue::Entry Entry;
+    auto farther = [](const Entry &a, const Entry &b){return a.dist > b.dist;};
+    auto nearer = [](const Neighbour &a, const Neighbour &b){return a.dist < b.dist;};
+
+    if(!root || k == 0)
+        return;
+
+    const std::size_t first = out.size();
+    Walk walk;
+    // the boxes are keyed and pruned by their squared distance, which needs no root. Once
+    // k are found one no nearer than the farthest of them is pruned as well
+    Scalar bound = maxdist, bound2 = maxdist * maxdist;
+    bool full = false;
+    std::vector<Entry> &queue = heap.entries;
+    queue.clear();
+    queue.push_back(Entry{root->minDistanceSquared(point), root});
+
+    while(!queue.empty()){
+        std::pop_heap(queue.begin(), queue.end(), farther);
+        const Entry e = queue.back();
+        queue.pop_back();
+
+        if(e.dist > bound2 || (full && e.dist == bound2))
+            break;
+        ++walk.visited;
+
+        if(e.node->leafchild){
+            walk.tested += e.node->child.size();
+            for(auto i: e.node->child){
+                // the box first, a payload is no nearer than its box
+                const Scalar d2 = i->minDistanceSquared(point);
+                if(d2 > bound2 || (full && d2 == bound2))
+                    continue;
+                const Scalar d = static_cast<const Leafnode*>(i)->distanceTo(point);
+                if(d > bound || (full && d == bound))
+                    continue;
+
+                out.push_back(Neighbour{static_cast<const Leafnode*>(i)->cir, d});
+                std::push_heap(out.begin() + first, out.end(), nearer);
+                if(out.size() - first > k){
+                    std::pop_heap(out.begin() + first, out.end(), nearer);
+                    out.pop_back();
+                }
+                if(out.size() - first == k){
+                    full = true;
+                    bound = out[first].dist;
+                    bound2 = bound * bound;
+                }
+            }
+            continue;
+        }
+
+        for(auto i: e.node->child){
+            const Scalar d2 = i->minDistanceSquared(point);
+            if(d2 < bound2 || (!full && d2 == bound2)){
+                queue.push_back(Entry{d2, static_cast<const Innernode*>(i)});
+                std::push_heap(queue.begin(), queue.end(), farther);
+            }
+        }
+    }
+
+    std::sort_heap(out.begin() + first, out.end(), nearer);
+    walk.returned = out.size() - first;
+    Count(walk);
+}
+
+QRTREE_TEMPLATE
+void QRTREE_CLASS::Innerquery(Innernode* inode, const Box &bb, std::vector<Leafnode>* result, QRRefine refine){
+    // S2
+    if(inode->leafchild){
+        const BoxWindow window{bb, refine == QRRefine::Exact};
+        for(auto i: inode->child){
+            if(window.accept(*static_cast<Leafnode*>(i)))
+                result->push_back(*(static_cast<Leafnode*>(i)));
+        }
+    }
+
+    // S1 
+    else{
+        for(auto i: inode->child){
+            if(i->overlaps(bb)){
+                Innerquery(static_cast<Innernode*>(i), bb, result, refine);
+            }
+        }
+    }
+    return;
+}
+
+QRTREE_TEMPLATE
+void QRTREE_CLASS::DeleteLeaf(Leafnode *leaf){
+    // D2
+    Own(leaf->parent);
+    auto x = find(leaf->parent->child.begin(), leaf->parent->child.end(), leaf);
+
+    // could x be end???
+    if(x != leaf->parent->child.end())
+        leaf->parent->child.erase(x);
+    else
+        std::cout << "not found\n";     // not found的圆在别处存在，本处已经不是了, 
+        
+    // D3, no leaf removed yet
+    CondenseTree(leaf);
+
+    if(leaf->prev)
+        leaf->prev->next = leaf->next;
+    if(leaf->next)
+        leaf->next->prev = leaf->prev;
+    
+    Notify(*leaf, QREvent::Left);
+    FreeLeaf(leaf); 
+    // std::cout << "delete done\n"; 
+
+    // D4：当_root的孩子是叶子时，不能改变层次 
+    if((_root->child.size() == 1) && (!_root->leafchild)){
+        auto oroot = _root;
+        _root = static_cast<Innernode*>(_root->child[0]); 
+        _root->parent = nullptr;
+        FreeInner(oroot);
+        ++_counters.root_changes;
+    }
+
+}
+
+// Subtrees inside the region go at once, without a look at their leaves but to unlink
+// them from the FIFO. The nodes on the paths down to the others are condensed children
+// first, once each, and what they eliminated is reinserted together at the end.
+QRTREE_TEMPLATE
+void QRTREE_CLASS::Delete(Box target, QRRefine refine){
+    if(_root == nullptr)
+        return;
+
+    auto &changed = _expire_buf;
+    changed.clear();
+    _condense_buf.clear();
+    InnerDelete(_root, BoxWindow{target, refine == QRRefine::Exact}, changed);
+
+    for(auto N: changed)
+        if(N != _root)
+            CondenseNode(N);
+    if(!_root->child.empty()){
+        _root->init();
+        std::for_each(_root->child.begin(), _root->child.end(), ExpandNode<Box>(_root));
+    }
+    ReinsertCondensed(true);
+    Publish();
+}
+
+// every node on the way down is owned first, so that the ones above stay those that were
+// walked, and child i is read again after the walk below it
+QRTREE_TEMPLATE
+bool QRTREE_CLASS::InnerDelete(Innernode *inode, const BoxWindow &window, std::vector<Innernode*> &changed){
+    inode = Own(inode);
+    const std::size_t n = inode->child.size();
+    std::size_t kept = 0;
+    bool below = false;
+
+    for(std::size_t i = 0; i < n; ++i){
+        Box *c = inode->child[i];
+        if(inode->leafchild){
+            if(window.accept(*static_cast<Leafnode*>(c))){
+                Notify(*static_cast<Leafnode*>(c), QREvent::Left);
+                Unlink(static_cast<Leafnode*>(c));
+                FreeLeaf(static_cast<Leafnode*>(c));
+                continue;
+            }
+        }
+        else if(window.bb.contains(*c)){
+            DropSubtree(static_cast<Innernode*>(c));
+            continue;
+        }
+        else if(c->overlaps(window.bb)){
+            below |= InnerDelete(static_cast<Innernode*>(c), window, changed);
+            c = inode->child[i];
+        }
+        inode->child[kept++] = c;
+    }
+
+    // the children that changed are already in changed, this node goes after them
+    const bool lost = below || kept < n;
+    inode->child.resize(kept);
+    if(lost)
+        changed.push_back(inode);
+    return lost;
+}
+
+QRTREE_TEMPLATE
+void QRTREE_CLASS::DropSubtree(Innernode *inode){
+    auto &stack = _level_buf;
+    stack.assign(1, inode);
+    while(!stack.empty()){
+        auto i = stack.back();
+        stack.pop_back();
+
+        for(auto j: i->child){
+            if(i->leafchild){
+                Notify(*static_cast<Leafnode*>(j), QREvent::Left);
+                Unlink(static_cast<Leafnode*>(j));
+                FreeLeaf(static_cast<Leafnode*>(j));
+            }
+            else
+                stack.push_back(static_cast<Innernode*>(j));
+        }
+        FreeInner(i);
+    }
+}
+
+QRTREE_TEMPLATE
+void QRTREE_CLASS::Unlink(Leafnode *leaf){
+    if(leaf->prev)
+        leaf->prev->next = leaf->next;
+    else
+        front = leaf->next;
+    if(leaf->next)
+        leaf->next->prev = leaf->prev;
+    else
+        end = leaf->prev;
+    --_size;
+}
+
+// not Guttman's Algorithm, since in my case usually a region not a specific node
+// would be removed, so there are must massive leaf nodes which overlap the target
+// region to be deleted
+QRTREE_TEMPLATE
+void QRTREE_CLASS::FindLeaf(Innernode* inode, const Box &tar, std::vector<Leafnode*> &toDelete, QRRefine refine){
+    if(inode->leafchild){
+        const BoxWindow window{tar, refine == QRRefine::Exact};
+        for(auto i: inode->child){
+            if(window.accept(*static_cast<Leafnode*>(i)))
+                toDelete.push_back(static_cast<Leafnode*>(i));
+        }
+        return;
+    }
+    else{
+        for(auto i: inode->child){
+            if(i->overlaps(tar)){
+                FindLeaf(static_cast<Innernode*>(i), tar, toDelete, refine);
+            }
+        }
+        return;
+    }
+}
+
+QRTREE_TEMPLATE
+void QRTREE_CLASS::CondenseTree(Leafnode *del){
+    // CT1
+    auto N = del->parent;
+    auto P = N->parent;
+    auto &Q = _condense_buf;
+    Q.clear();
+  
+    // CT2: if N is the root, goto CT6
+    // quod _root update not so on time, old _root may cause problem
+    while(N != _root){
+        // otherweise let P be the parent of N, and let En be N's entry in P
+        P = N->parent;
+  
+        // CT3: if N has fewer than m entries,
+        if(N->child.size() < min_child){
+            // delete En from P(since no two nodes share same boundingbox)
+            // type not compatible
+            auto x = find(P->child.begin(), P->child.end(), static_cast<Box*>(N));
+            if(x != P->child.end())
+                P->child.erase(x);
+
+            // and add N to Q
+            Q.push_back(N);
+        }
+        // CT4: if N has not been elimanated, adjust EnI to tightly contain all entries in N
+        else{
+            N->init();
+            std::for_each(N->child.begin(), N->child.end(), ExpandNode<Box>(N));
+            Summarise(N);
+        }
+
+        // CT5: set N = P and repeat from CT2
+        N = P;
+        
+    }
+
+    ReinsertCondensed();
+}
+
+// Leaves all hang at one depth, so the level above is only looked at once every node
+// of this one is done, and a node with many expired children is condensed once.
+QRTREE_TEMPLATE
+void QRTREE_CLASS::CondenseLevels(std::vector<Innernode*> &level){
+    _condense_buf.clear();
+    auto &above = _level_buf;
+
+    // a level holding the root holds nothing else
+    while(!level.empty() && level[0] != _root){
+        above.clear();
+        for(auto N: level){
+            above.push_back(N->parent);
+            CondenseNode(N);
+        }
+        std::sort(above.begin(), above.end());
+        above.erase(std::unique(above.begin(), above.end()), above.end());
+        level.swap(above);
+    }
+
+    ReinsertCondensed();
+}
+
+// An underfull node goes into the sibling that grows least if both fit in one node, only
+// the rest are eliminated and reinserted from the root.
+QRTREE_TEMPLATE
+void QRTREE_CLASS::CondenseNode(Innernode *N){
+    auto P = N->parent;
+    N->init();
+    std::for_each(N->child.begin(), N->child.end(), ExpandNode<Box>(N));
+    Summarise(N);
+    if(N->child.size() >= min_child)
+        return;
+
+    auto x = find(P->child.begin(), P->child.end(), static_cast<Box*>(N));
+    if(x != P->child.end())
+        P->child.erase(x);
+
+    Innernode *into = nullptr;
+    Scalar least = std::numeric_limits<Scalar>::max();
+    for(auto i: P->child){
+        auto S = static_cast<Innernode*>(i);
+        if(S->child.size() + N->child.size() > (std::size_t)max_child)
+            continue;
+        Box merged = *S;
+        merged.expandToContain(*N);
+        // only neighbours, else the merged node covers the gap between them
+        if(merged.area() > S->area() + N->area())
+            continue;
+        if(merged.area() - S->area() < least){
+            least = merged.area() - S->area();
+            into = S;
+        }
+    }
+    if(!into && !N->child.empty()){
+        _condense_buf.push_back(N);
+        return;
+    }
+
+    if(into){
+        into = Own(into);
+        for(auto c: N->child){
+            if(N->leafchild)
+                static_cast<Leafnode*>(c)->parent = into;
+            else
+                static_cast<Innernode*>(c)->parent = into;
+            into->child.push_back(c);
+        }
+        into->expandToContain(*N);
+        Summarise(into, N);
+    }
+    FreeInner(N);
+}
+
+QRTREE_TEMPLATE
+void QRTREE_CLASS::ReinsertCondensed(bool subtrees){
+    auto &Q = _condense_buf;
+
+    // CT6: reinsert all entries of nodes in set Q. don't have to use Guttman's method,
+    // since redistribution may generate a better performance.
+    // find all leaves of a certain node.
+
+    // the condense passes stop below the root, whose summary is redone here
+    _root = Own(_root);
+    Summarise(_root);
+
+    // D4 may be needed before reinsertion: the root could have lost all but one
+    // of its children, or all of them
+    while(!_root->leafchild && _root->child.size() == 1){
+        auto oroot = _root;
+        _root = static_cast<Innernode*>(_root->child[0]);
+        _root->parent = nullptr;
+        FreeInner(oroot);
+        ++_counters.root_changes;
+    }
+    if(_root->child.empty()){
+        _root = Own(_root);
+        _root->leafchild = true;
+        _root->init();
+    }
+
+    // the eliminated subtrees are already detached from the tree, so collect their
+    // leaves first and free the inner nodes, then reinsert. Q serves as the stack
+    auto &orphans = _orphan_buf;
+    orphans.clear();
+    auto &whole = _level_buf;
+    whole.clear();
+    const int height = _root->getLevel();
+    while(!Q.empty()){
+        auto item = Q.back();
+        Q.pop_back();
+
+        if(item->leafchild)
+            for(auto k: item->child)
+                orphans.push_back(static_cast<Leafnode*>(k));
+        else
+            for(auto k: item->child){
+                // a subtree as high as the tree is taken apart
+                if(subtrees && static_cast<Innernode*>(k)->getLevel() < height)
+                    whole.push_back(static_cast<Innernode*>(k));
+                else
+                    Q.push_back(static_cast<Innernode*>(k));
+            }
+
+        FreeInner(item);
+    }
+
+    _counters.condensed += orphans.size() + whole.size();
+    for(auto i: whole)
+        Insert(i, _root);
+    for(auto i: orphans)
+        Insert(i, _root);
+
+}
+
+QRTREE_TEMPLATE
+void QRTREE_CLASS::Destroy(Innernode* inode){
+    // no reader may be left when the tree is destroyed, so nothing below is retired
+    if(inode == _root){
+        Reclaim(QREpoch::idle);
+        _published.store(nullptr);
+    }
+    if(inode == nullptr)
+        return;
+
+    // the whole tree lives in the slabs, drop them at once
+    if(inode == _root && _leafpool.slab() && _innerpool.slab()){
+        _leafpool.clear();
+        _innerpool.clear();
+        _root = nullptr;
+        front = end = nullptr;
+        _size = 0;
+        return;
+    }
+
+    std::vector<Innernode*> toDelete{inode};
+    while(!toDelete.empty()){
+        auto i = toDelete.back();
+        toDelete.pop_back();
+
+        for(auto j: i->child){
+            if(i->leafchild){
+                RecycleLeaf(static_cast<Leafnode*>(j));
+                --_size;
+            }
+            else
+                toDelete.push_back(static_cast<Innernode*>(j));
+        }
+        RecycleInner(i);
+    }
+
+    if(inode == _root){
+        _root = nullptr;
+        front = end = nullptr;
+    }
+}
+
+QRTREE_TEMPLATE
+typename QRTREE_CLASS::Leafnode* QRTREE_CLASS::NewLeaf(Payload &&tar){
+    Leafnode* leaf = _leafpool.get();
+    static_cast<Box&>(*leaf) = Traits::bounds(tar);
+    leaf->cir = std::move(tar);
+    leaf->id = ++_ids;
+    return leaf;
+}
+
+// recycled nodes keep their child capacity, fresh ones get room for an overflow
+QRTREE_TEMPLATE
+typename QRTREE_CLASS::Innernode* QRTREE_CLASS::NewInner(bool leafchild){
+    Innernode* inode = _innerpool.get();
+    inode->child.clear();
+    inode->child.reserve(max_child + 1);
+    inode->leafchild = leafchild;
+    inode->parent = nullptr;
+    inode->version = _version;
+    return inode;
+}
+
+QRTREE_TEMPLATE
+typename QRTREE_CLASS::Innernode* QRTREE_CLASS::Own(Innernode *inode){
+    if(inode->version == _version)
+        return inode;
+    if(!_concurrent){
+        for(Innernode *i = inode; i && i->version != _version; i = i->parent)
+            i->version = _version;
+        return inode;
+    }
+
+    Innernode *copy = NewInner(inode->leafchild);
+    static_cast<Box&>(*copy) = *inode;
+#if QRTREE_AGGREGATE
+    copy->summary = inode->summary;
+#endif
+#if QRTREE_STAMPS
+    copy->stamp_min = inode->stamp_min;
+    copy->stamp_max = inode->stamp_max;
+#endif
+    copy->child.assign(inode->child.begin(), inode->child.end());
+
+    // the parent first, so that the copy is linked into the current version
+    if(inode->parent){
+        Innernode *parent = Own(inode->parent);
+        *std::find(parent->child.begin(), parent->child.end(), static_cast<Box*>(inode)) = copy;
+        copy->parent = parent;
+    }
+    else{
+        assert(inode == _root);
+        _root = copy;
+    }
+
+    if(copy->leafchild)
+        for(auto i: copy->child)
+            static_cast<Leafnode*>(i)->parent = copy;
+    else
+        for(auto i: copy->child)
+            static_cast<Innernode*>(i)->parent = copy;
+
+    FreeInner(inode);
+    return copy;
+}
+
+QRTREE_TEMPLATE
+void QRTREE_CLASS::Summarise(Innernode *inode){
+#if QRTREE_AGGREGATE
+    inode->summary = Summary();
+    if(inode->leafchild)
+        for(auto i: inode->child)
+            inode->summary.add(Traits::summary(static_cast<Leafnode*>(i)->cir));
+    else
+        for(auto i: inode->child)
+            inode->summary.add(static_cast<Innernode*>(i)->summary);
+#endif
+#if QRTREE_STAMPS
+    inode->stamp_min = std::numeric_limits<std::uint64_t>::max();
+    inode->stamp_max = 0;
+    if(inode->leafchild)
+        for(auto i: inode->child){
+            inode->stamp_min = std::min(inode->stamp_min, static_cast<Leafnode*>(i)->stamp);
+            inode->stamp_max = std::max(inode->stamp_max, static_cast<Leafnode*>(i)->stamp);
+        }
+    else
+        for(auto i: inode->child){
+            inode->stamp_min = std::min(inode->stamp_min, static_cast<Innernode*>(i)->stamp_min);
+            inode->stamp_max = std::max(inode->stamp_max, static_cast<Innernode*>(i)->stamp_max);
+        }
+#endif
+}
+
+QRTREE_TEMPLATE
+void QRTREE_CLASS::Summarise(Innernode *inode, const Leafnode *leaf){
+#if QRTREE_AGGREGATE
+    inode->summary.add(Traits::summary(leaf->cir));
+#endif
+#if QRTREE_STAMPS
+    inode->stamp_min = std::min(inode->stamp_min, leaf->stamp);
+    inode->stamp_max = std::max(inode->stamp_max, leaf->stamp);
+#endif
+}
+
+QRTREE_TEMPLATE
+void QRTREE_CLASS::Summarise(Innernode *inode, const Innernode *subtree){
+#if QRTREE_AGGREGATE
+    inode->summary.add(subtree->summary);
+#endif
+#if QRTREE_STAMPS
+    inode->stamp_min = std::min(inode->stamp_min, subtree->stamp_min);
+    inode->stamp_max = std::max(inode->stamp_max, subtree->stamp_max);
+#endif
+}
+
+// Inner nodes in preorder, the leaves of a leaf-parent right after its own. Writes between
+// steps may leave the path pointing elsewhere, then the walk goes on from where it lands
+// and whatever it passed by is moved in another pass. A pass walked within one call saw
+// every node, so after it nothing is left in the old slabs.
+QRTREE_TEMPLATE
+bool QRTREE_CLASS::CompactStep(std::size_t n){
+    assert(!_concurrent);
+    auto &path = _compact_path;
+    if(!_compacting){
+        if(!_root || !_leafpool.slab() || !_innerpool.slab())
+            return true;
+        _old_leafpool.swap(_leafpool);
+        _old_innerpool.swap(_innerpool);
+        _compact_left = _old_leafpool.live() + _old_innerpool.live();
+        _leafpool.reserve(_old_leafpool.live());
+        _innerpool.reserve(_old_innerpool.live());
+        _moved.reserve(_moved.size() + _old_leafpool.live());
+        _compacting = true;
+        path.clear();
+    }
+
+    bool whole = path.empty();
+    std::size_t done = 0;
+    while(done < n){
+        // down the path, a level without the child it names is done
+        Innernode *node = _root;
+        std::size_t depth = 0;
+        while(depth < path.size() && !node->leafchild && path[depth] < node->child.size())
+            node = static_cast<Innernode*>(node->child[path[depth++]]);
+        if(depth < path.size()){
+            path.resize(depth);
+            if(!path.empty()){
+                ++path.back();
+                continue;
+            }
+        }
+        else{
+            if(!_innerpool.owns(node))
+                node = MoveInner(node);
+            ++done;
+            if(node->leafchild){
+                for(std::size_t i = 0; i < node->child.size(); ++i)
+                    if(!_leafpool.owns(static_cast<Leafnode*>(node->child[i])))
+                        MoveLeaf(node, i);
+                done += node->child.size();
+            }
+            else if(!node->child.empty()){
+                path.push_back(0);
+                continue;
+            }
+            if(!path.empty()){
+                ++path.back();
+                continue;
+            }
+        }
+
+        // end of a pass
+        if(_compact_left == 0 || whole){
+            _old_leafpool.clear();
+            _old_innerpool.clear();
+            _compacting = false;
+            ++_moves;
+            return true;
+        }
+        whole = true;
+    }
+    return false;
+}
+
+QRTREE_TEMPLATE
+typename QRTREE_CLASS::Innernode* QRTREE_CLASS::MoveInner(Innernode *inode){
+    Innernode *copy = NewInner(inode->leafchild);
+    static_cast<Box&>(*copy) = *inode;
+    copy->child.assign(inode->child.begin(), inode->child.end());
+    copy->parent = inode->parent;
+    copy->version = inode->version;
+#if QRTREE_AGGREGATE
+    copy->summary = inode->summary;
+#endif
+#if QRTREE_STAMPS
+    copy->stamp_min = inode->stamp_min;
+    copy->stamp_max = inode->stamp_max;
+#endif
+
+    if(inode->parent)
+        *std::find(inode->parent->child.begin(), inode->parent->child.end(), static_cast<Box*>(inode)) = copy;
+    else
+        _root = copy;
+    if(copy->leafchild)
+        for(auto i: copy->child)
+            static_cast<Leafnode*>(i)->parent = copy;
+    else
+        for(auto i: copy->child)
+            static_cast<Innernode*>(i)->parent = copy;
+
+    // the old node is destroyed with its slab, its child list can go now
+    std::vector<Box*>().swap(inode->child);
+    --_compact_left;
+    return copy;
+}
+
+QRTREE_TEMPLATE
+void QRTREE_CLASS::MoveLeaf(Innernode *parent, std::size_t i){
+    Leafnode *leaf = static_cast<Leafnode*>(parent->child[i]);
+    Leafnode *copy = _leafpool.get();
+    static_cast<Box&>(*copy) = *leaf;
+    copy->cir = std::move(leaf->cir);
+    copy->parent = parent;
+    copy->prev = leaf->prev;
+    copy->next = leaf->next;
+    copy->stamp = leaf->stamp;
+    copy->id = leaf->id;
+    _moved[copy->id] = copy;
+
+    parent->child[i] = copy;
+    if(copy->prev)
+        copy->prev->next = copy;
+    else
+        front = copy;
+    if(copy->next)
+        copy->next->prev = copy;
+    else
+        end = copy;
+
+    if(!std::is_trivially_destructible<Payload>::value)
+        leaf->cir = Payload();
+    leaf->id = 0;
+    --_compact_left;
+}
+
+// end of a write: new readers get the current version, and whatever was retired
+// before the last reader still pinned goes back to the pools
+QRTREE_TEMPLATE
+void QRTREE_CLASS::Publish(){
+    if(!_concurrent)
+        return;
+    _published.store(_root);
+    _epoch.Advance();
+    ++_version;
+    Reclaim(_epoch.MinPinned());
+}
+
+QRTREE_TEMPLATE
+void QRTREE_CLASS::Reclaim(std::uint64_t before){
+    while(!_retired_inner.empty() && _retired_inner.front().first < before){
+        RecycleInner(_retired_inner.front().second);
+        _retired_inner.pop_front();
+    }
+    while(!_retired_leaf.empty() && _retired_leaf.front().first < before){
+        RecycleLeaf(_retired_leaf.front().second);
+        _retired_leaf.pop_front();
+    }
+}
+
+QRTREE_TEMPLATE
+void QRTREE_CLASS::Set_concurrent(bool on){
+    if(on == _concurrent)
+        return;
+    // a Compact under way would move nodes readers may see, it is finished first. Nothing
+    // is moved otherwise, handles stay valid
+    if(on && _compacting)
+        Compact();
+    // nothing can be pinned now
+    Reclaim(QREpoch::idle);
+    _concurrent = on;
+    // the nodes so far belong to the version readers will see first
+    ++_version;
+    _published.store(on ? _root : nullptr);
+}
+
+QRTREE_TEMPLATE
+typename QRTREE_CLASS::Counters QRTREE_CLASS::Get_counters() const{
+    Counters counters = _counters;
+    for(const auto &walked: _walked){
+        counters.queries += walked.queries.load(std::memory_order_relaxed);
+        counters.visited += walked.visited.load(std::memory_order_relaxed);
+        counters.tested += walked.tested.load(std::memory_order_relaxed);
+        counters.returned += walked.returned.load(std::memory_order_relaxed);
+    }
+    return counters;
+}
+
+QRTREE_TEMPLATE
+void QRTREE_CLASS::ResetStats(){
+    _counters = Counters();
+    for(auto &walked: _walked){
+        walked.queries.store(0, std::memory_order_relaxed);
+        walked.visited.store(0, std::memory_order_relaxed);
+        walked.tested.store(0, std::memory_order_relaxed);
+        walked.returned.store(0, std::memory_order_relaxed);
+    }
+}
+
+// one level at a time from the root
+QRTREE_TEMPLATE
+typename QRTREE_CLASS::Statistics QRTREE_CLASS::Stats() const{
+    Statistics stats;
+    stats.size = _size;
+    stats.counters = Get_counters();
+
+    std::vector<const Innernode*> level, below;
+    if(_root)
+        level.push_back(_root);
+    while(!level.empty()){
+        below.clear();
+        std::vector<std::size_t> fill(max_child + 1, 0);
+        Scalar overlap = 0, dead = 0;
+
+        for(auto N: level){
+            const std::size_t n = N->child.size();
+            ++fill[std::min(n, fill.size() - 1)];
+            if(n == 0)
+                continue;
+
+            Scalar covered = 0, shared = 0;
+            for(std::size_t i = 0; i < n; ++i){
+                covered += N->child[i]->area();
+                for(std::size_t j = i + 1; j < n; ++j)
+                    shared += N->child[i]->overlapArea(*N->child[j]);
+            }
+            overlap += shared;
+            dead += std::max(Scalar(0), N->area() - covered + shared);
+
+            if(!N->leafchild)
+                for(auto i: N->child)
+                    below.push_back(static_cast<const Innernode*>(i));
+        }
+
+        ++stats.height;
+        stats.nodes.push_back(level.size());
+        stats.fill.push_back(std::move(fill));
+        stats.overlap.push_back(overlap);
+        stats.dead.push_back(dead);
+        stats.total_overlap += overlap;
+        stats.total_dead += dead;
+        level.swap(below);
+    }
+    return stats;
+}
+
+QRTREE_TEMPLATE
+void QRTREE_CLASS::BulkLoad(std::vector<Payload> &&data, QRPacking packing, const std::uint64_t *stamps){
+    // older circles would be expired right away
+    const std::size_t first = data.size() > _size_full ? data.size() - _size_full : 0;
+    if(first == data.size())
+        return;
+
+    std::vector<Box*> level;
+    level.reserve(data.size() - first);
+
+    // leaves are linked into the FIFO list in the given order
+    Leafnode *last = nullptr;
+    for(std::size_t i = first; i < data.size(); ++i){
+        Leafnode *leaf = NewLeaf(std::move(data[i]));
+        if(stamps){
+            assert(stamps[i] >= _stamp);
+            _stamp = stamps[i];
+        }
+        else
+            ++_stamp;
+        leaf->stamp = _stamp;
+        leaf->prev = last;
+        leaf->next = nullptr;
+        if(last)
+            last->next = leaf;
+        else
+            front = leaf;
+        last = leaf;
+        level.push_back(leaf);
+    }
+    end = last;
+    _size = level.size();
+    data.clear();
+    data.shrink_to_fit();
+
+    bool leafchild = true;
+    do{
+        level = PackLevel(level, leafchild, packing);
+        leafchild = false;
+    }while(level.size() > 1);
+
+    _root = static_cast<Innernode*>(level[0]);
+    _root->parent = nullptr;
+}
+
+// k parents on a grid of about k^(1/Dim) slabs per axis: sort along axis, cut into slabs
+// of whole parents, then tile each slab on the axes after it
+QRTREE_TEMPLATE
+void QRTREE_CLASS::TileLevel(typename std::vector<Box*>::iterator first, typename std::vector<Box*>::iterator last,
+    int axis, std::size_t k){
+    std::sort(first, last, [axis](const Box *a, const Box *b){
+        return a->range[axis].first + a->range[axis].second < b->range[axis].first + b->range[axis].second;
+    });
+    if(axis + 1 == Dim || k <= 1)
+        return;
+
+    const std::size_t slabs = (std::size_t)std::ceil(std::pow((double)k, 1.0 / (Dim - axis)));
+    const std::size_t slab_n = (k + slabs - 1) / slabs * max_child;
+    for(auto i = first; i != last; ){
+        auto j = i + std::min<std::ptrdiff_t>(slab_n, last - i);
+        TileLevel(i, j, axis + 1, (j - i + max_child - 1) / max_child);
+        i = j;
+    }
+}
+
+QRTREE_TEMPLATE
+std::uint64_t QRTREE_CLASS::CurveKey(const Box &bound, const Box &b){
+    // as many bits per axis as fit the 64-bit index, 16 at most
+    const int bits = std::min(16, 64 / Dim);
+    const double cells = (1u << bits) - 1;
+
+    std::uint32_t cell[Dim];
+    for(int d = 0; d < Dim; ++d){
+        const double extent = std::max((double)bound.range[d].second - bound.range[d].first, 1e-12);
+        const double centre = ((double)b.range[d].first + b.range[d].second) / 2;
+        cell[d] = (std::uint32_t)((centre - bound.range[d].first) / extent * cells);
+    }
+    return QRHilbertIndex(cell, Dim, bits);
+}
+
+// sort one level of nodes in packing order and group them into parents of max_child
+// entries each. Only the last two parents may hold less, and never less than min_child.
+QRTREE_TEMPLATE
+std::vector<typename QRTREE_CLASS::Box*> QRTREE_CLASS::PackLevel(std::vector<Box*> &items, bool leafchild, QRPacking packing){
+    const std::size_t n = items.size();
+    const std::size_t k = (n + max_child - 1) / max_child;
+
+    if(packing == QRPacking::STR)
+        TileLevel(items.begin(), items.end(), 0, k);
+    // upper levels keep the curve order of the level below
+    else if(leafchild){
+        Box bound;
+        bound.init();
+        std::for_each(items.begin(), items.end(), ExpandNode<Box>(&bound));
+
+        std::vector<std::pair<std::uint64_t, Box*>> keyed;
+        keyed.reserve(n);
+        for(auto i: items)
+            keyed.emplace_back(CurveKey(bound, *i), i);
+        std::sort(keyed.begin(), keyed.end(), [](const std::pair<std::uint64_t, Box*> &a, const std::pair<std::uint64_t, Box*> &b){
+            return a.first < b.first;
+        });
+        for(std::size_t i = 0; i < n; ++i)
+            items[i] = keyed[i].second;
+    }
+
+    std::vector<std::size_t> sizes(k, max_child);
+    sizes.back() = n - (k - 1) * max_child;
+    if(k > 1 && sizes.back() < (std::size_t)min_child){
+        sizes[k - 2] -= min_child - sizes.back();
+        sizes.back() = min_child;
+    }
+
+    std::vector<Box*> parents;
+    parents.reserve(k);
+    auto item = items.begin();
+    for(auto size: sizes){
+        Innernode *inode = NewInner(leafchild);
+        inode->child.assign(item, item + size);
+        item += size;
+
+        inode->init();
+        std::for_each(inode->child.begin(), inode->child.end(), ExpandNode<Box>(inode));
+        Summarise(inode);
+
+        if(leafchild)
+            for(auto i: inode->child)
+                static_cast<Leafnode*>(i)->parent = inode;
+        else
+            for(auto i: inode->child)
+                static_cast<Innernode*>(i)->parent = inode;
+
+        parents.push_back(inode);
+    }
+    return parents;
+}
+
+QRTREE_TEMPLATE
+QRTREE_CLASS::QueryIterator::QueryIterator(const Innernode *root, const Box &bb, QRRefine refine):
+    window{bb, refine == QRRefine::Exact}, top(-1), cur(nullptr){
+    if(root && window.enter(*root)){
+        stack[++top] = Frame{root, 0};
+        advance();
+    }
+}
+
+// move on to the next overlapping leaf, depth first in child order
+QRTREE_TEMPLATE
+void QRTREE_CLASS::QueryIterator::advance(){
+    while(top >= 0){
+        Frame &f = stack[top];
+        if(f.index == f.node->child.size()){
+            --top;
+            continue;
+        }
+
+        const Box *item = f.node->child[f.index++];
+
+        if(f.node->leafchild){
+            if(!window.accept(*static_cast<const Leafnode*>(item)))
+                continue;
+            cur = static_cast<const Leafnode*>(item);
+            return;
+        }
+        if(!window.enter(*item))
+            continue;
+        assert(top + 1 < QRTREE_MAX_HEIGHT);
+        stack[++top] = Frame{static_cast<const Innernode*>(item), 0};
+    }
+    cur = nullptr;
+}
+
+#endif